@@ -0,0 +1,56 @@
+/* cachestat.c
+
+   Samples the buffer cache statistics, by default once, or
+   COUNT times with INTERVAL loop iterations of busy-waiting in
+   between, and prints how much each counter changed.
+
+   Usage: cachestat [COUNT [INTERVAL]] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+static void
+print_stats (const struct cache_stats *cur, const struct cache_stats *prev)
+{
+  uint64_t hits = cur->hits - prev->hits;
+  uint64_t lookups = hits + (cur->misses - prev->misses);
+
+  printf ("%8llu hits %8llu misses %3llu%% %6llu evict %6llu wb "
+          "%6llu ra %6llu ra-hit %6lld wait\n",
+          hits, cur->misses - prev->misses,
+          lookups ? hits * 100 / lookups : 0,
+          cur->evictions - prev->evictions,
+          cur->writebacks - prev->writebacks,
+          cur->readaheads - prev->readaheads,
+          cur->readahead_hits - prev->readahead_hits,
+          cur->io_wait_ticks - prev->io_wait_ticks);
+}
+
+int
+main (int argc, char *argv[])
+{
+  struct cache_stats prev = { 0, 0, 0, 0, 0, 0, 0 };
+  struct cache_stats cur;
+  int count = argc > 1 ? atoi (argv[1]) : 1;
+  int interval = argc > 2 ? atoi (argv[2]) : 1000000;
+  int i;
+
+  for (i = 0; i < count; i++)
+    {
+      volatile int spin;
+
+      if (!cachestat (&cur))
+        {
+          printf ("%s: cachestat failed\n", argv[0]);
+          return EXIT_FAILURE;
+        }
+      print_stats (&cur, &prev);
+      prev = cur;
+
+      if (i + 1 < count)
+        for (spin = 0; spin < interval; spin++)
+          continue;
+    }
+  return EXIT_SUCCESS;
+}
@@ -1,188 +1,901 @@
 #include "filesys/cache.h"
 #include <list.h>
+#include <hash.h>
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "devices/block.h"
+#include "devices/timer.h"
 #include "filesys/filesys.h"
 #include "threads/interrupt.h"
-#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 
-static struct list cache_block_list;
+/* Number of cache slots that share one page of data. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* Most dirty blocks the flusher writes back per batch.  A batch
+ * is copied into one page of its own before going to disk. */
+#define CACHE_FLUSH_BATCH SECTORS_PER_PAGE
+
+/* A bucket of the sector index.  Its lock protects the chain as
+ * well as the state of every block on it: valid, dirty,
+ * writeback, readers, writing and io.  A block can't change
+ * buckets while any of those pin it, so holding a pin is enough
+ * to find the right lock again later. */
+struct cache_bucket
+  {
+    struct lock lock;
+    struct list blocks;
+
+    /* Statistics for lookups that land in this bucket. */
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readaheads;
+    uint64_t readahead_hits;
+    int64_t io_wait_ticks;
+  };
+
+/* Number of sectors the cache holds.  Controlled by kernel
+ * command-line option "-cache-size". */
+size_t cache_size = CACHE_SIZE;
+
+/* Every slot the cache will ever use, cache_size of them.  Their
+ * data lives in cache_pages, SECTORS_PER_PAGE slots to a page, so
+ * reusing a slot never goes through the allocator.  Both arrays
+ * are taken from the kernel pool once, at boot. */
+static struct cache_block *cache_blocks;
+static uint8_t *cache_pages;
+
+/* Slots that don't hold a sector yet. */
+static struct list cache_free_list;
+
+/* Next slot the clock hand will look at. */
+static size_t clock_hand;
+
+/* Replacement policy used by evict_block().  Controlled by kernel
+ * command-line option "-cache-policy". */
+enum cache_policy cache_policy = CACHE_POLICY_CLOCK;
+
+/* Dirty-ratio watermarks, in percent of cache_size.  Once more
+ * than cache_dirty_high percent of the cache is dirty the flusher
+ * is woken early and writes back until no more than
+ * cache_dirty_low percent is.  Controlled by kernel command-line
+ * options "-cache-dirty-high" and "-cache-dirty-low". */
+int cache_dirty_high = 50;
+int cache_dirty_low = 20;
+
+/* Sector index: each bucket chains the blocks whose sector
+ * hashes to it, so lookups don't depend on cache_size, and
+ * lookups of sectors in different buckets don't contend.  There
+ * are cache_bucket_cnt buckets, a power of 2 sized so that chains
+ * stay about one block long however large the cache is. */
+static struct cache_bucket *cache_buckets;
+static size_t cache_bucket_cnt;
+
+/* Dirty blocks not yet picked up by the flusher, oldest first. */
+static struct list cache_dirty_list;
+static size_t cache_dirty_cnt;
+
+/* Statistics kept under cache_lock.  The rest are per bucket. */
+static uint64_t cache_evictions;
+static uint64_t cache_writebacks;
+
+/* Protects slot allocation: the free list, the clock hand and the
+ * dirty list.  May be acquired while holding a bucket lock, but
+ * never the other way around, except with lock_try_acquire(). */
 static struct lock cache_lock;
 
+/* Serializes flush_batch().  A block written back by one batch
+ * may be dirtied and queued again before the write completes; a
+ * second batch running at the same time would write the sector
+ * again and clear the first batch's writeback flag early.  Never
+ * acquired while holding another cache lock. */
+static struct lock flush_lock;
+
+/* Signaled whenever the flusher finishes a batch, so that an
+ * eviction that found nothing clean can try again. */
+static struct condition cache_clean_cond;
+
+/* Ups wake the flusher: periodically from buffer_cache_tick(),
+ * and early when the dirty ratio crosses cache_dirty_high. */
+static struct semaphore flush_sema;
+
+/* Set by buffer_cache_tick() when it is time to write back every
+ * dirty block, not just enough to get under cache_dirty_low. */
+static bool flush_all;
+
+/* Set by buffer_cache_tick() every CACHE_TIMER_FREQ ticks, so that
+ * the flusher ages the cache at that cadence and not also on the
+ * early wake-ups from writers. */
+static bool age_due;
+
+/* Read-ahead requests: a ring of sectors waiting to be brought
+ * in by the read-ahead daemon.  Requests that find the ring full
+ * are dropped, since read-ahead is only a hint. */
+static block_sector_t ra_queue[CACHE_READAHEAD_QUEUE];
+static size_t ra_head, ra_tail;
+static struct lock ra_lock;
+static struct semaphore ra_sema;
+
 // Makes sure that the cache has been initialized
 bool fs_buffer_cache_is_inited = false;
 
+static thread_func cache_flusher NO_RETURN;
+static thread_func cache_readahead_daemon NO_RETURN;
+
 /* Checks if the block is already in the cache. */
-struct cache_block * block_in_cache(struct inode *inode, block_sector_t sector_idx);
+static struct cache_block * block_in_cache(struct cache_bucket *b,
+                                           block_sector_t sector_idx);
+static struct cache_block * evict_block(struct cache_bucket *held);
+
+/* Returns the index bucket that SECTOR_IDX belongs to. */
+static inline struct cache_bucket *
+cache_bucket(block_sector_t sector_idx) {
+    return &cache_buckets[hash_int(sector_idx) & (cache_bucket_cnt - 1)];
+}
+
+/* Returns true if the dirty ratio is above PERCENT. */
+static inline bool
+dirty_above(int percent) {
+    return cache_dirty_cnt * 100 > (size_t) percent * cache_size;
+}
+
+/* Allocates PAGE_CNT contiguous pages from the kernel pool for
+ * the cache, panicking with a hint about "-cache-size" if there
+ * isn't enough memory. */
+static void *
+cache_alloc(size_t page_cnt) {
+    void *pages = palloc_get_multiple(0, page_cnt);
+    if (pages == NULL) {
+        PANIC("not enough memory for a %zu-sector buffer cache "
+              "(try a smaller -cache-size)", cache_size);
+    }
+    return pages;
+}
 
-/* Initialize all necessary structures. */
+/* Initialize all necessary structures and start the flusher. */
 void buffer_cache_init(void) {
-    list_init(&cache_block_list);
+    size_t i;
+
+    ASSERT(cache_size > 0);
+
+    cache_bucket_cnt = CACHE_BUCKETS_MIN;
+    while (cache_bucket_cnt < cache_size) {
+        cache_bucket_cnt *= 2;
+    }
+    cache_buckets = cache_alloc(DIV_ROUND_UP(cache_bucket_cnt
+                                             * sizeof *cache_buckets,
+                                             PGSIZE));
+    for (i = 0; i < cache_bucket_cnt; i++) {
+        lock_init(&cache_buckets[i].lock);
+        list_init(&cache_buckets[i].blocks);
+        cache_buckets[i].hits = 0;
+        cache_buckets[i].misses = 0;
+        cache_buckets[i].readaheads = 0;
+        cache_buckets[i].readahead_hits = 0;
+        cache_buckets[i].io_wait_ticks = 0;
+    }
+
+    cache_blocks = cache_alloc(DIV_ROUND_UP(cache_size * sizeof *cache_blocks,
+                                            PGSIZE));
+    cache_pages = cache_alloc(DIV_ROUND_UP(cache_size, SECTORS_PER_PAGE));
+    list_init(&cache_free_list);
+    for (i = 0; i < cache_size; i++) {
+        struct cache_block *c = &cache_blocks[i];
+        c->block = cache_pages + i * BLOCK_SECTOR_SIZE;
+        c->valid = false;
+        c->dirty = false;
+        c->writeback = false;
+        c->io = false;
+        c->queued = false;
+        c->writing = false;
+        c->readers = 0;
+        c->accessed = false;
+        c->prefetched = false;
+        c->count = 0;
+        c->inode = NULL;
+        cond_init(&c->wait);
+        list_push_back(&cache_free_list, &c->elem);
+    }
+    clock_hand = 0;
+
+    list_init(&cache_dirty_list);
+    cache_dirty_cnt = 0;
+    cache_evictions = cache_writebacks = 0;
     lock_init(&cache_lock);
+    lock_init(&flush_lock);
+    cond_init(&cache_clean_cond);
+    sema_init(&flush_sema, 0);
+    flush_all = false;
+    age_due = false;
+
+    ra_head = ra_tail = 0;
+    lock_init(&ra_lock);
+    sema_init(&ra_sema, 0);
     fs_buffer_cache_is_inited = true;
+
+    thread_create("cache-flush", PRI_DEFAULT, cache_flusher, NULL);
+    thread_create("cache-readahead", PRI_DEFAULT, cache_readahead_daemon,
+                  NULL);
 }
 
-/* Returns the block if the desired block is currently in the
- * cache and null otherwise. */
-struct cache_block * block_in_cache(struct inode *inode, block_sector_t sector_idx) {
+/* Returns the block if the desired block is currently in bucket
+ * B and null otherwise. The caller must hold B's lock. */
+static struct cache_block * block_in_cache(struct cache_bucket *b,
+                                           block_sector_t sector_idx) {
     struct list_elem *e;
     struct cache_block *c;
 
-    lock_acquire(&cache_list_lock);
-    e = list_begin(&cache_block_list);
+    ASSERT(lock_held_by_current_thread(&b->lock));
 
-    // Iterate through the list and get the proper block
-    while (e != list_end(&cache_block_list) && e != NULL) {
-        c = list_entry(e, struct cache_block, elem);
-        if (c->inode == inode && c->sector_idx == sector_idx) {
-            lock_release(&cache_list_lock);
+    for (e = list_begin(&b->blocks); e != list_end(&b->blocks);
+         e = list_next(e)) {
+        c = list_entry(e, struct cache_block, hash_elem);
+        if (c->sector_idx == sector_idx) {
             return c;
         }
-        e = list_next(e);
     }
-    lock_release(&cache_list_lock);
     return NULL;
 }
 
-/* Reads a block from the cache. If it's not currently there, it 
- * finds the correct block from memory and puts it in the cache, 
- * evicting another block if necessary.
- * Returns a pointer to a buffer that can be read from. */
-uint8_t * cache_read(struct inode *inode, block_sector_t sector_idx) {
+/* Takes a slot off the free list, or evicts one if there are
+ * none left.  Eviction only takes clean, idle blocks and never
+ * does disk I/O.  Returns a null pointer if there was nothing to
+ * take right now.  The slot is on no list when returned.  The
+ * caller must hold HELD's lock. */
+static struct cache_block * cache_get_slot(struct cache_bucket *held) {
     struct cache_block *c;
-    uint8_t *buffer = NULL;
-
-    /* Check if the block is in the cache. */
-    c = block_in_cache(inode, sector_idx);
-
-    /* If it isn't, find the corresponding data in the filesystem
-     * and allocate a new block for it and put it into the buffer, 
-     * evicting an old block if necessary. */
-    if (c == NULL) {
-        buffer = malloc(BLOCK_SECTOR_SIZE);
-        if(buffer == NULL) { return NULL; }
-
-        // Read the block from disk
-        block_read(fs_device, sector_idx, buffer);
-
-        // Place the block to the cache
-        c = malloc(sizeof(struct cache_block));
-        if(c == NULL) { return NULL; }
-        c->inode = inode;
-        c->sector_idx = sector_idx;
-        c->block = buffer;
-        c->count = 0;
-        c->accessed = true;
-        c->dirty = false;
-        while (list_size(&cache_block_list) >= CACHE_SIZE) {
-            evict_block();
-        }
-        lock_acquire(&cache_list_lock);
-        list_push_back(&cache_block_list, &c->elem);
-        lock_release(&cache_list_lock);
+
+    lock_acquire(&cache_lock);
+    if (!list_empty(&cache_free_list)) {
+        c = list_entry(list_pop_front(&cache_free_list),
+                       struct cache_block, elem);
     }
     else {
-        c->accessed = true;
+        c = evict_block(held);
     }
-    return c->block;
+    lock_release(&cache_lock);
+    return c;
 }
 
-/* Writes the data in a buffer to disk. This is called on two 
- * occasions:
- * 1. When a block is evicted (in evict_block()).
- * 2. Periodically when all dirty blocks are written back to disk
- *    (in buffer_cache_tick()). */
-void cache_write_to_disk(struct cache_block *c) {
-    lock_acquire(filesys_lock_list + c->sector_idx);
-    block_write(fs_device, c->sector_idx, c->block);
-    lock_release(filesys_lock_list + c->sector_idx);
+/* Waits for the flusher to clean some blocks, after a call to
+ * cache_get_slot() found none to evict. */
+static void
+cache_wait_clean(void) {
+    lock_acquire(&cache_lock);
+    sema_up(&flush_sema);
+    cond_wait(&cache_clean_cond, &cache_lock);
+    lock_release(&cache_lock);
+}
+
+/* Puts free slot C into bucket B for SECTOR_IDX, marked as having
+ * I/O in progress so that anyone else who looks it up waits for
+ * the caller to fill it.  The caller must hold B's lock. */
+static void
+cache_insert(struct cache_bucket *b, struct cache_block *c,
+             struct inode *inode, block_sector_t sector_idx) {
+    ASSERT(lock_held_by_current_thread(&b->lock));
+
+    c->inode = inode;
+    c->sector_idx = sector_idx;
+    c->count = 0;
+    c->accessed = true;
+    c->prefetched = false;
     c->dirty = false;
+    c->writeback = false;
+    c->writing = false;
+    c->readers = 0;
+    c->io = true;
+    c->valid = true;
+    list_push_back(&b->blocks, &c->hash_elem);
 }
 
-/* Uses an aging replacement policy to find the block to evict. */
-void evict_block(void) {
-    struct list_elem *e;
-    struct list_elem *remove_elem;
+/* Fills block C, which the caller inserted into bucket B with
+ * cache_insert(), from disk (or with zeros if READ is false) and
+ * wakes anyone waiting for it.  Called without B's lock, returns
+ * with it held. */
+static void
+cache_fill(struct cache_bucket *b, struct cache_block *c, bool read) {
+    if (read) {
+        block_read(fs_device, c->sector_idx, c->block);
+    }
+    else {
+        memset(c->block, 0, BLOCK_SECTOR_SIZE);
+    }
+
+    lock_acquire(&b->lock);
+    c->io = false;
+    cond_broadcast(&c->wait, &b->lock);
+}
+
+/* Returns the block holding SECTOR_IDX, bringing it into the
+ * cache first if necessary, pinned for reading or, if WRITE is
+ * true, for writing.  Any number of readers may hold a block at
+ * once, but a writer holds it alone.  Two threads that miss on
+ * the same sector don't both read it: the second finds the
+ * first's block with I/O in progress and waits for it.  If READ
+ * is false the caller is about to overwrite the whole sector, so
+ * a missing sector is zeroed instead of read from disk.  Release
+ * the block with cache_put(). */
+static struct cache_block * cache_get(struct inode *inode,
+                                      block_sector_t sector_idx,
+                                      bool read, bool write) {
+    struct cache_bucket *b = cache_bucket(sector_idx);
+    struct cache_block *c;
+    int64_t start = timer_ticks();
+    int64_t waited = 0;
+
+    for (;;) {
+        lock_acquire(&b->lock);
+
+        /* Check if the block is in the cache. */
+        c = block_in_cache(b, sector_idx);
+        if (c != NULL
+            && (c->io || c->writing || (write && c->readers > 0))) {
+            /* Waiting drops the bucket lock, and the block may be
+             * evicted and reused for another sector meanwhile, so
+             * look it up again afterward. */
+            while (c->io || c->writing || (write && c->readers > 0)) {
+                cond_wait(&c->wait, &b->lock);
+            }
+            waited = timer_elapsed(start);
+            lock_release(&b->lock);
+            continue;
+        }
+        if (c != NULL) {
+            b->hits++;
+            if (c->prefetched) {
+                b->readahead_hits++;
+                c->prefetched = false;
+            }
+            break;
+        }
+
+        c = cache_get_slot(b);
+        if (c != NULL) {
+            b->misses++;
+            cache_insert(b, c, inode, sector_idx);
+            lock_release(&b->lock);
+            cache_fill(b, c, read);
+            waited = timer_elapsed(start);
+            break;
+        }
+
+        lock_release(&b->lock);
+        cache_wait_clean();
+    }
+
+    b->io_wait_ticks += waited;
+    c->accessed = true;
+    if (write) {
+        c->writing = true;
+    }
+    else {
+        c->readers++;
+    }
+    lock_release(&b->lock);
+    return c;
+}
+
+/* Releases block C, obtained from cache_get() with the same
+ * WRITE.  A writer's block is marked dirty and queued for the
+ * flusher. */
+static void
+cache_put(struct cache_block *c, bool write) {
+    struct cache_bucket *b = cache_bucket(c->sector_idx);
+    bool wake_flusher = false;
+
+    lock_acquire(&b->lock);
+    if (write) {
+        c->writing = false;
+        if (!c->dirty) {
+            c->dirty = true;
+            lock_acquire(&cache_lock);
+            list_push_back(&cache_dirty_list, &c->dirty_elem);
+            c->queued = true;
+            cache_dirty_cnt++;
+            wake_flusher = dirty_above(cache_dirty_high);
+            lock_release(&cache_lock);
+        }
+        cond_broadcast(&c->wait, &b->lock);
+    }
+    else if (--c->readers == 0) {
+        cond_broadcast(&c->wait, &b->lock);
+    }
+    lock_release(&b->lock);
+
+    if (wake_flusher) {
+        sema_up(&flush_sema);
+    }
+}
+
+/* Copies SIZE bytes of SECTOR_IDX, starting SECTOR_OFS bytes
+ * into the sector, into BUFFER.  If the sector isn't in the cache
+ * it is read from disk into a free or evicted slot first. */
+void cache_read(struct inode *inode, block_sector_t sector_idx,
+                void *buffer, int sector_ofs, int size) {
+    struct cache_block *c;
+
+    ASSERT(sector_ofs >= 0 && size >= 0);
+    ASSERT(sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+    c = cache_get(inode, sector_idx, true, false);
+    memcpy(buffer, c->block + sector_ofs, size);
+    cache_put(c, false);
+}
+
+/* Copies SIZE bytes from BUFFER into the cached copy of
+ * SECTOR_IDX, starting SECTOR_OFS bytes into the sector, and
+ * marks the block dirty.  The flusher writes it back later. */
+void cache_write(struct inode *inode, block_sector_t sector_idx,
+                 const void *buffer, int sector_ofs, int size) {
+    struct cache_block *c;
+    bool whole = sector_ofs == 0 && size == BLOCK_SECTOR_SIZE;
+
+    ASSERT(sector_ofs >= 0 && size >= 0);
+    ASSERT(sector_ofs + size <= BLOCK_SECTOR_SIZE);
+
+    c = cache_get(inode, sector_idx, !whole, true);
+    memcpy(c->block + sector_ofs, buffer, size);
+    cache_put(c, true);
+}
+
+/* Returns true if block C can be evicted right away, without
+ * writing it to disk or waiting for anyone first.  The caller
+ * must hold the lock of C's bucket. */
+static inline bool
+evictable(const struct cache_block *c) {
+    return (c->valid && !c->dirty && !c->writeback && !c->io
+            && !c->writing && c->readers == 0);
+}
+
+/* Evicts C if it is still evictable once its bucket is locked.
+ * HELD is the bucket whose lock the caller already holds; any
+ * other bucket is only try-locked, since the caller also holds
+ * cache_lock and must not wait on a bucket lock while doing so. */
+static bool
+try_evict(struct cache_block *c, struct cache_bucket *held) {
+    struct cache_bucket *b;
+    bool evicted = false;
+
+    if (!c->valid) {
+        return false;
+    }
+    b = cache_bucket(c->sector_idx);
+    if (b != held && !lock_try_acquire(&b->lock)) {
+        return false;
+    }
+    if (evictable(c) && cache_bucket(c->sector_idx) == b) {
+        c->valid = false;
+        list_remove(&c->hash_elem);
+        cache_evictions++;
+        evicted = true;
+    }
+    if (b != held) {
+        lock_release(&b->lock);
+    }
+    return evicted;
+}
+
+/* Advances the clock hand to the next evictable slot, giving
+ * every recently accessed slot it passes a second chance.
+ * Evicts and returns the first slot found whose accessed bit was
+ * clear, or returns a null pointer if there is no clean block to
+ * evict. */
+static struct cache_block * clock_choose(struct cache_bucket *held) {
+    struct cache_block *c;
+    size_t steps;
+
+    /* Two sweeps are enough: the first clears every accessed bit. */
+    for (steps = 0; steps < 2 * cache_size; steps++) {
+        c = &cache_blocks[clock_hand];
+        clock_hand = (clock_hand + 1) % cache_size;
+        if (!c->valid || c->dirty) {
+            continue;
+        }
+        if (c->accessed) {
+            c->accessed = false;
+            continue;
+        }
+        if (try_evict(c, held)) {
+            return c;
+        }
+    }
+    return NULL;
+}
+
+/* Evicts and returns the clean slot with the lowest aging count.
+ * If that one turns out to be busy, falls back to the clock. */
+static struct cache_block * aging_choose(struct cache_bucket *held) {
     struct cache_block *c;
     struct cache_block *evict = NULL;
-    int lowest_count;
-
-    lock_acquire(&cache_list_lock);
-    e = list_begin(&cache_block_list);
-    ASSERT(e != NULL);
-    c = list_entry(e, struct cache_block, elem);
-    evict = c;
-    lowest_count = c->count;
-    remove_elem = e;
-    while (e != list_end(&cache_block_list)) {
-        c = list_entry(e, struct cache_block, elem);
-        if (c->count < lowest_count) {
-            lowest_count = c->count;
+    size_t i;
+
+    for (i = 0; i < cache_size; i++) {
+        c = &cache_blocks[i];
+        if (c->valid && !c->dirty
+            && (evict == NULL || c->count < evict->count)) {
             evict = c;
-            remove_elem = e;
         }
-        e = list_next(e);
     }
+    if (evict != NULL && try_evict(evict, held)) {
+        return evict;
+    }
+    return clock_choose(held);
+}
+
+/* Picks a clean, idle block to evict using cache_policy, takes it
+ * out of the index and returns its slot for reuse, or a null
+ * pointer if there is none.  Never does disk I/O.  The caller
+ * must hold cache_lock and HELD's lock. */
+static struct cache_block * evict_block(struct cache_bucket *held) {
+    ASSERT(lock_held_by_current_thread(&cache_lock));
 
-    ASSERT(evict != NULL);
-    list_remove(remove_elem);
-    /* Write to filesystem if block was dirty */
-    if (evict->dirty) {
-        cache_write_to_disk(evict);
+    if (cache_policy == CACHE_POLICY_AGING) {
+        return aging_choose(held);
     }
-    lock_release(&cache_list_lock);
-    /* Free memory. */
-    free(evict->block);
-    free(evict); 
+    return clock_choose(held);
 }
 
-/* 1. Updates the count of each block depending on whether or 
- *    not it's been accessed since the last timer tick. 
- * 2. Writes all dirty blocks back to disk. */
-void buffer_cache_tick(int64_t cur_ticks) {
-    if(!fs_buffer_cache_is_inited) { return; } // Haven't inited buffer cache yet
+/* Orders blocks by sector, so a batch goes to disk in one sweep. */
+static int
+compare_sectors(const void *a_, const void *b_) {
+    const struct cache_block *a = *(struct cache_block * const *) a_;
+    const struct cache_block *b = *(struct cache_block * const *) b_;
 
-    struct list_elem *e;
+    return a->sector_idx < b->sector_idx ? -1 : a->sector_idx > b->sector_idx;
+}
+
+/* Writes back one batch of up to CACHE_FLUSH_BATCH of the oldest
+ * dirty blocks.  Each block's data is copied into BOUNCE and the
+ * block marked clean while holding its bucket lock; the disk
+ * writes happen without any lock, so readers and writers are
+ * never stuck behind them.  The blocks stay pinned by their
+ * writeback flag until the write has reached disk, so they can't
+ * be evicted and re-read stale in the meantime.  Only one batch
+ * is in flight at a time, see flush_lock.  Returns the number of
+ * blocks written. */
+static size_t
+flush_batch(uint8_t *bounce) {
+    struct cache_block *batch[CACHE_FLUSH_BATCH];
+    block_sector_t sectors[CACHE_FLUSH_BATCH];
+    size_t cnt = 0;
+    size_t i;
+
+    lock_acquire(&flush_lock);
+
+    /* A block on the dirty list is pinned by its dirty flag, so its
+     * sector can't change after it is taken off. */
+    lock_acquire(&cache_lock);
+    while (cnt < CACHE_FLUSH_BATCH && !list_empty(&cache_dirty_list)) {
+        batch[cnt] = list_entry(list_pop_front(&cache_dirty_list),
+                                struct cache_block, dirty_elem);
+        batch[cnt++]->queued = false;
+        cache_dirty_cnt--;
+    }
+    cache_writebacks += cnt;
+    lock_release(&cache_lock);
+
+    qsort(batch, cnt, sizeof *batch, compare_sectors);
+    for (i = 0; i < cnt; i++) {
+        struct cache_block *c = batch[i];
+        struct cache_bucket *b = cache_bucket(c->sector_idx);
+
+        lock_acquire(&b->lock);
+        while (c->writing) {
+            cond_wait(&c->wait, &b->lock);
+        }
+        c->dirty = false;
+        c->writeback = true;
+        memcpy(bounce + i * BLOCK_SECTOR_SIZE, c->block, BLOCK_SECTOR_SIZE);
+        sectors[i] = c->sector_idx;
+        lock_release(&b->lock);
+    }
+
+    for (i = 0; i < cnt; i++) {
+        block_write(fs_device, sectors[i], bounce + i * BLOCK_SECTOR_SIZE);
+    }
+
+    for (i = 0; i < cnt; i++) {
+        struct cache_block *c = batch[i];
+        struct cache_bucket *b = cache_bucket(c->sector_idx);
+
+        lock_acquire(&b->lock);
+        c->writeback = false;
+        cond_broadcast(&c->wait, &b->lock);
+        lock_release(&b->lock);
+    }
+
+    lock_acquire(&cache_lock);
+    cond_broadcast(&cache_clean_cond, &cache_lock);
+    lock_release(&cache_lock);
+
+    lock_release(&flush_lock);
+    return cnt;
+}
+
+/* Ages every block's count under the aging policy: shifts it
+ * right and moves the accessed bit into its top bit.  Counts and
+ * accessed bits are only hints, so this takes no locks. */
+static void
+cache_age(void) {
     struct cache_block *c;
-    bool accessed;
+    size_t i;
 
-    if (cur_ticks % CACHE_TIMER_FREQ == 0) {
-        e = list_begin(&cache_block_list);
-        while (e != list_end(&cache_block_list) && e != NULL) {
-            c = list_entry(e, struct cache_block, elem);
-            accessed = c->accessed;
-            c->count = c->count >> 1;
-            c->count &= (accessed << (sizeof(c->count) - 1));
+    for (i = 0; i < cache_size; i++) {
+        c = &cache_blocks[i];
+        c->count = (c->count >> 1) | (c->accessed ? CACHE_AGE_MSB : 0);
+        c->accessed = false;
+    }
+}
+
+/* Write-behind thread.  Sleeps until buffer_cache_tick() or a
+ * writer crossing cache_dirty_high wakes it, ages the cache if
+ * the aging policy is in use and the wake-up came from the timer,
+ * and then writes back dirty blocks
+ * in batches: all of them on a periodic flush, otherwise just
+ * enough to get down to cache_dirty_low. */
+static void
+cache_flusher(void *aux UNUSED) {
+    uint8_t *bounce = palloc_get_page(PAL_ASSERT);
+
+    for (;;) {
+        enum intr_level old_level;
+        bool all, age;
+
+        sema_down(&flush_sema);
+
+        /* Both flags are set from the timer interrupt. */
+        old_level = intr_disable();
+        all = flush_all;
+        flush_all = false;
+        age = age_due;
+        age_due = false;
+        intr_set_level(old_level);
+
+        if (age && cache_policy == CACHE_POLICY_AGING) {
+            cache_age();
+        }
+
+        for (;;) {
+            bool more;
+
+            lock_acquire(&cache_lock);
+            more = all ? cache_dirty_cnt > 0 : dirty_above(cache_dirty_low);
+            lock_release(&cache_lock);
+            if (!more || flush_batch(bounce) == 0) {
+                break;
+            }
+        }
+
+        /* An eviction may be waiting for a clean block even though
+         * there was nothing for us to write. */
+        lock_acquire(&cache_lock);
+        cond_broadcast(&cache_clean_cond, &cache_lock);
+        lock_release(&cache_lock);
+    }
+}
+
+/* Asks the read-ahead daemon to bring SECTOR_IDX into the cache.
+ * Returns immediately; the read happens asynchronously, or not at
+ * all if too many requests are already pending. */
+void cache_readahead(block_sector_t sector_idx) {
+    bool queued = false;
+
+    lock_acquire(&ra_lock);
+    if (ra_head - ra_tail < CACHE_READAHEAD_QUEUE) {
+        ra_queue[ra_head++ % CACHE_READAHEAD_QUEUE] = sector_idx;
+        queued = true;
+    }
+    lock_release(&ra_lock);
+
+    if (queued) {
+        sema_up(&ra_sema);
+    }
+}
+
+/* Brings SECTOR_IDX into the cache for the read-ahead daemon,
+ * unless it is already there or there is no clean slot to put it
+ * in.  A prefetched block starts with its accessed bit clear, so
+ * a block nobody ends up reading is among the first the clock
+ * hand takes back. */
+static void
+cache_prefetch(block_sector_t sector_idx) {
+    struct cache_bucket *b = cache_bucket(sector_idx);
+    struct cache_block *c;
+
+    lock_acquire(&b->lock);
+    if (block_in_cache(b, sector_idx) == NULL) {
+        c = cache_get_slot(b);
+        if (c != NULL) {
+            cache_insert(b, c, NULL, sector_idx);
             c->accessed = false;
-            e = list_next(e);
+            c->prefetched = true;
+            b->readaheads++;
+            lock_release(&b->lock);
+            cache_fill(b, c, true);
         }
     }
+    lock_release(&b->lock);
+}
 
-    if (cur_ticks % CACHE_WRITE_ALL_FREQ == 0) {
-      // Disable interrupts before we try to acquire a lock
-      // So that we don't accidentally get interrupted by
-      // the same handler and acquire the same lock again.
-      enum intr_level old_level = intr_disable();
-
-      // Only try acquire because we might be in the interrupt context
-      // for the thread that holds this lock
-      if(lock_try_acquire(&cache_list_lock)) {
-
-        e = list_begin(&cache_block_list);
-        while (e != list_end(&cache_block_list) && e != NULL) {
-            c = list_entry(e, struct cache_block, elem);
-            if (c->dirty) {
-                cache_try_write_to_disk(c);
-                c->dirty = false;
+/* Read-ahead thread.  Brings each requested sector into the
+ * cache. */
+static void
+cache_readahead_daemon(void *aux UNUSED) {
+    for (;;) {
+        block_sector_t sector_idx;
+
+        sema_down(&ra_sema);
+
+        lock_acquire(&ra_lock);
+        sector_idx = ra_queue[ra_tail++ % CACHE_READAHEAD_QUEUE];
+        lock_release(&ra_lock);
+
+        cache_prefetch(sector_idx);
+    }
+}
+
+/* Drops block C, in bucket B, from the cache without writing it
+ * back, unless someone is using it or the flusher has already
+ * taken it off the dirty list.  The caller must hold B's lock. */
+static void
+cache_drop(struct cache_bucket *b, struct cache_block *c) {
+    ASSERT(lock_held_by_current_thread(&b->lock));
+
+    if (c->io || c->writing || c->readers > 0 || c->writeback) {
+        return;
+    }
+
+    lock_acquire(&cache_lock);
+    if (!c->dirty || c->queued) {
+        if (c->dirty) {
+            list_remove(&c->dirty_elem);
+            c->queued = false;
+            c->dirty = false;
+            cache_dirty_cnt--;
+        }
+        c->valid = false;
+        list_remove(&c->hash_elem);
+        list_push_back(&cache_free_list, &c->elem);
+    }
+    lock_release(&cache_lock);
+}
+
+/* Drops any cached copies of the CNT sectors starting at
+ * SECTOR_IDX, which are being freed, so that their slots are
+ * reused first and dirty ones are never written back.  The
+ * sectors must not be reallocated until this returns. */
+void cache_invalidate(block_sector_t sector_idx, size_t cnt) {
+    size_t i;
+
+    if(!fs_buffer_cache_is_inited) { return; }
+
+    if (cnt <= cache_size) {
+        /* Look each sector up. */
+        for (i = 0; i < cnt; i++) {
+            struct cache_bucket *b = cache_bucket(sector_idx + i);
+            struct cache_block *c;
+
+            lock_acquire(&b->lock);
+            c = block_in_cache(b, sector_idx + i);
+            if (c != NULL) {
+                cache_drop(b, c);
             }
-            e = list_next(e);
+            lock_release(&b->lock);
+        }
+        return;
+    }
+
+    /* More sectors than slots: check each slot instead.  A slot's
+     * sector can change until its bucket is locked, so check it
+     * again once it is. */
+    for (i = 0; i < cache_size; i++) {
+        struct cache_block *c = &cache_blocks[i];
+        struct cache_bucket *b;
+
+        if (!c->valid || c->sector_idx - sector_idx >= cnt) {
+            continue;
+        }
+        b = cache_bucket(c->sector_idx);
+        lock_acquire(&b->lock);
+        if (c->valid && c->sector_idx - sector_idx < cnt
+            && cache_bucket(c->sector_idx) == b) {
+            cache_drop(b, c);
+        }
+        lock_release(&b->lock);
+    }
+}
+
+/* Writes every dirty block back to disk and waits for any batch
+ * the flusher has in flight.  Called when the file system shuts
+ * down. */
+void cache_flush(void) {
+    uint8_t *bounce;
+    size_t i;
+
+    if(!fs_buffer_cache_is_inited) { return; }
+
+    bounce = palloc_get_page(PAL_ASSERT);
+    while (flush_batch(bounce) > 0) {
+        continue;
+    }
+    palloc_free_page(bounce);
+
+    for (i = 0; i < cache_size; i++) {
+        struct cache_block *c = &cache_blocks[i];
+        struct cache_bucket *b = cache_bucket(c->sector_idx);
+
+        lock_acquire(&b->lock);
+        while (c->valid && c->writeback) {
+            cond_wait(&c->wait, &b->lock);
         }
-      lock_release(&cache_list_lock);
+        lock_release(&b->lock);
     }
-      intr_set_level(old_level);
+}
+
+/* Stores a snapshot of the cache's statistics in *STATS.  The
+ * counters are read bucket by bucket, so a snapshot taken while
+ * the cache is busy may not be exactly consistent. */
+void cache_get_stats(struct cache_stats *stats) {
+    size_t i;
+
+    memset(stats, 0, sizeof *stats);
+    if(!fs_buffer_cache_is_inited) { return; }
+
+    for (i = 0; i < cache_bucket_cnt; i++) {
+        struct cache_bucket *b = &cache_buckets[i];
+
+        lock_acquire(&b->lock);
+        stats->hits += b->hits;
+        stats->misses += b->misses;
+        stats->readaheads += b->readaheads;
+        stats->readahead_hits += b->readahead_hits;
+        stats->io_wait_ticks += b->io_wait_ticks;
+        lock_release(&b->lock);
     }
 
+    lock_acquire(&cache_lock);
+    stats->evictions = cache_evictions;
+    stats->writebacks = cache_writebacks;
+    lock_release(&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void cache_print_stats(void) {
+    struct cache_stats s;
+    uint64_t lookups;
+
+    if(!fs_buffer_cache_is_inited) { return; }
+
+    cache_get_stats(&s);
+    lookups = s.hits + s.misses;
+    printf("Cache: %llu hits, %llu misses (%llu%% hit rate), "
+           "%llu evictions, %llu writebacks\n",
+           s.hits, s.misses, lookups ? s.hits * 100 / lookups : 0,
+           s.evictions, s.writebacks);
+    printf("Cache: %llu read-aheads, %llu read-ahead hits, "
+           "%lld ticks blocked on I/O\n",
+           s.readaheads, s.readahead_hits, s.io_wait_ticks);
+}
+
+/* Called from the timer interrupt.  Wakes the flusher every
+ * CACHE_TIMER_FREQ ticks, and asks it to write back everything
+ * every CACHE_WRITE_ALL_FREQ ticks.  All of the real work happens
+ * in the flusher thread, never in interrupt context. */
+void buffer_cache_tick(int64_t cur_ticks) {
+    if(!fs_buffer_cache_is_inited) { return; } // Haven't inited buffer cache yet
+
+    if (cur_ticks % CACHE_WRITE_ALL_FREQ == 0) {
+        flush_all = true;
+    }
+    if (cur_ticks % CACHE_TIMER_FREQ == 0) {
+        age_due = true;
+        sema_up(&flush_sema);
+    }
 }
@@ -1,31 +1,88 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
 #include <stdbool.h>
 #include "filesys/off_t.h"
 #include "devices/block.h"
 #include <list.h>
+#include "threads/synch.h"
+#include <cache-stats.h>
 
 #define CACHE_TIMER_FREQ 100
+#define CACHE_WRITE_ALL_FREQ 500
 
+/* Default number of sectors in the cache. */
 #define CACHE_SIZE 64
 
+/* Most significant bit of a block's aging count. */
+#define CACHE_AGE_MSB (1u << 31)
+
+/* Fewest buckets in the sector index.  Must be a power of 2. */
+#define CACHE_BUCKETS_MIN 64
+
+/* Most read-ahead requests that may be waiting at once. */
+#define CACHE_READAHEAD_QUEUE 64
+
+/* Buffer cache replacement policies. */
+enum cache_policy
+  {
+    CACHE_POLICY_CLOCK,         /* Second chance on the accessed bit. */
+    CACHE_POLICY_AGING          /* Lowest aging count, aged every tick. */
+  };
+
 struct cache_block{
 
-	bool dirty;
+	bool valid;                 /* Holds a sector in the index? */
+	bool dirty;                 /* Modified since last written back? */
+	bool writeback;             /* Being written back by the flusher? */
 	bool accessed;
-	int count;
+	bool prefetched;            /* Read ahead and not looked up since? */
+	bool io;                    /* Being filled; wait on WAIT. */
+	bool queued;                /* On the dirty list?  Under cache_lock. */
+	bool writing;               /* Held by a writer? */
+	int readers;                /* Number of readers holding it. */
+	struct condition wait;      /* Signaled when the above change. */
+	unsigned count;             /* Aging count, see buffer_cache_tick(). */
 	struct inode *inode;
 
 	/* The disk sector of the inode. */
     block_sector_t sector_idx;
 
-    /* The block of memory allocated for the data. 
-     * For some reason, this is defined as a uint8_t * in 
-     * inode.c (see the bounce buffer), so I left it the 
-     * same here. */
+    /* The slot's BLOCK_SECTOR_SIZE bytes of data, carved out of
+     * the pages reserved in buffer_cache_init(). */
     uint8_t *block;
 
-	struct list_elem elem;
+	struct list_elem elem;          /* Element in the free list. */
+	struct list_elem hash_elem;     /* Element in a sector index bucket. */
+	struct list_elem dirty_elem;    /* Element in the dirty list. */
 };
 
-extern bool filesys_cache_initiated;
+extern bool fs_buffer_cache_is_inited;
+
+/* Number of sectors in the buffer cache.
+   Controlled by kernel command-line option "-cache-size". */
+extern size_t cache_size;
+
+/* Replacement policy for the buffer cache.
+   Controlled by kernel command-line option "-cache-policy". */
+extern enum cache_policy cache_policy;
+
+/* Dirty-ratio high and low watermarks for write-behind, in percent.
+   Controlled by kernel command-line options "-cache-dirty-high"
+   and "-cache-dirty-low". */
+extern int cache_dirty_high;
+extern int cache_dirty_low;
 
+void buffer_cache_init(void);
+void cache_read(struct inode *inode, block_sector_t sector_idx,
+                void *buffer, int sector_ofs, int size);
+void cache_write(struct inode *inode, block_sector_t sector_idx,
+                 const void *buffer, int sector_ofs, int size);
+void cache_readahead(block_sector_t sector_idx);
+void cache_invalidate(block_sector_t sector_idx, size_t cnt);
+void cache_flush(void);
+void cache_get_stats(struct cache_stats *stats);
+void cache_print_stats(void);
+void buffer_cache_tick(int64_t cur_ticks);
 
+#endif /* filesys/cache.h */
@@ -2,9 +2,12 @@
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <hash.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
@@ -21,12 +24,254 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* A directory is stored in one of two formats.
+
+   A flat directory is just an array of struct dir_entry, searched
+   front to back.  Small directories stay flat, and directories
+   written by older kernels are flat.
+
+   A hashed directory starts with a header sector, followed by
+   BUCKET_CNT bucket sectors.  Each bucket holds the entries whose
+   names hash to it, so a lookup reads the header and one bucket.
+   When a bucket fills up, the directory is rehashed into twice as
+   many buckets.  The header overlays the first entry of a flat
+   directory as an entry that isn't in use, so the two can be told
+   apart by its magic number. */
+struct dir_header
+  {
+    block_sector_t magic;               /* DIR_MAGIC. */
+    uint32_t bucket_cnt;                /* Number of buckets. */
+  };
+
+/* Identifies a hashed directory. */
+#define DIR_MAGIC 0x48534944
+
+/* Entries per bucket sector. */
+#define DIR_BUCKET_ENTRIES (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* A flat directory with no free slot left is converted to the
+   hashed format once it holds this many entries. */
+#define DIR_FLAT_MAX DIR_BUCKET_ENTRIES
+
+/* Buckets in a directory that has just been converted. */
+#define DIR_BUCKETS_MIN 4
+
+/* Directory entry cache.
+
+   Remembers the result of recent lookups, keyed by the sector of
+   the directory's inode and the name looked up, so that looking
+   the same name up again costs no directory I/O.  A name that
+   wasn't found is remembered too, as a negative entry.  dir_add()
+   and dir_remove() keep the cache up to date, and dir_create()
+   drops anything left over from a directory that used the same
+   sector before.  A lookup that misses reads the directory and
+   caches what it found while holding the directory's lock, so it
+   can't cache a result that a concurrent dir_add() or
+   dir_remove() has already made stale. */
+struct dentry
+  {
+    struct list_elem hash_elem;         /* Element in a bucket. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+    block_sector_t dir_sector;          /* Directory's inode sector. */
+    char name[NAME_MAX + 1];            /* Name looked up. */
+    bool negative;                      /* NAME known not to exist? */
+    block_sector_t inode_sector;        /* NAME's inode, if it does. */
+  };
+
+/* Most entries the cache holds, and its number of buckets, which
+   must be a power of 2. */
+#define DCACHE_SIZE 256
+#define DCACHE_BUCKETS 64
+
+static struct list dcache_buckets[DCACHE_BUCKETS];
+static struct list dcache_lru;          /* Least recently used first. */
+static size_t dcache_cnt;
+static struct lock dcache_lock;
+
+/* Initializes the directory entry cache. */
+void
+dir_init (void)
+{
+  size_t i;
+
+  for (i = 0; i < DCACHE_BUCKETS; i++)
+    list_init (&dcache_buckets[i]);
+  list_init (&dcache_lru);
+  dcache_cnt = 0;
+  lock_init (&dcache_lock);
+}
+
+/* Returns the bucket for NAME in the directory at DIR_SECTOR. */
+static struct list *
+dcache_bucket (block_sector_t dir_sector, const char *name)
+{
+  unsigned hash = hash_string (name) ^ hash_int (dir_sector);
+  return &dcache_buckets[hash & (DCACHE_BUCKETS - 1)];
+}
+
+/* Returns the cached entry for NAME in the directory at
+   DIR_SECTOR, or a null pointer.  The caller must hold
+   dcache_lock. */
+static struct dentry *
+dcache_find (block_sector_t dir_sector, const char *name)
+{
+  struct list *bucket = dcache_bucket (dir_sector, name);
+  struct list_elem *e;
+
+  for (e = list_begin (bucket); e != list_end (bucket); e = list_next (e))
+    {
+      struct dentry *d = list_entry (e, struct dentry, hash_elem);
+      if (d->dir_sector == dir_sector && !strcmp (d->name, name))
+        return d;
+    }
+  return NULL;
+}
+
+/* Looks up NAME in the directory at DIR_SECTOR in the cache.
+   Returns true if it is cached, and then sets *FOUND to whether
+   NAME exists and, if it does, *INODE_SECTOR to its inode. */
+static bool
+dcache_lookup (block_sector_t dir_sector, const char *name,
+               bool *found, block_sector_t *inode_sector)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dcache_find (dir_sector, name);
+  if (d != NULL)
+    {
+      *found = !d->negative;
+      *inode_sector = d->inode_sector;
+      list_remove (&d->lru_elem);
+      list_push_back (&dcache_lru, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+  return d != NULL;
+}
+
+/* Records that NAME in the directory at DIR_SECTOR refers to the
+   inode at INODE_SECTOR, or, if FOUND is false, that it doesn't
+   exist.  Evicts the least recently used entry if the cache is
+   full.  Does nothing if memory can't be allocated. */
+static void
+dcache_insert (block_sector_t dir_sector, const char *name,
+               bool found, block_sector_t inode_sector)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dcache_find (dir_sector, name);
+  if (d == NULL)
+    {
+      if (dcache_cnt >= DCACHE_SIZE)
+        {
+          d = list_entry (list_pop_front (&dcache_lru),
+                          struct dentry, lru_elem);
+          list_remove (&d->hash_elem);
+        }
+      else
+        {
+          d = malloc (sizeof *d);
+          if (d == NULL)
+            {
+              lock_release (&dcache_lock);
+              return;
+            }
+          dcache_cnt++;
+        }
+      d->dir_sector = dir_sector;
+      strlcpy (d->name, name, sizeof d->name);
+      list_push_front (dcache_bucket (dir_sector, name), &d->hash_elem);
+    }
+  else
+    list_remove (&d->lru_elem);
+  list_push_back (&dcache_lru, &d->lru_elem);
+  d->negative = !found;
+  d->inode_sector = inode_sector;
+  lock_release (&dcache_lock);
+}
+
+/* Drops every cached entry for the directory at DIR_SECTOR. */
+static void
+dcache_purge (block_sector_t dir_sector)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&dcache_lru); e != list_end (&dcache_lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->dir_sector == dir_sector)
+        {
+          list_remove (&d->lru_elem);
+          list_remove (&d->hash_elem);
+          free (d);
+          dcache_cnt--;
+        }
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Reads DIR's header into *H and returns true if DIR is hashed,
+   false if it is flat. */
+static bool
+dir_read_header (const struct dir *dir, struct dir_header *h)
+{
+  return (inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h
+          && h->magic == DIR_MAGIC);
+}
+
+/* Returns the byte offset of the bucket that NAME belongs to, in
+   a hashed directory with header H. */
+static off_t
+bucket_ofs (const struct dir_header *h, const char *name)
+{
+  return (1 + (hash_string (name) & (h->bucket_cnt - 1))) * BLOCK_SECTOR_SIZE;
+}
+
+/* Reads the entry slot at or after *POS in a directory stored in
+   INODE into *E, and advances *POS past it.  In a hashed
+   directory, skips the header and the unused bytes at the end of
+   each bucket.  Returns false at end of directory. */
+static bool
+next_slot (struct inode *inode, bool hashed, off_t *pos, struct dir_entry *e)
+{
+  if (hashed)
+    {
+      if (*pos < BLOCK_SECTOR_SIZE)
+        *pos = BLOCK_SECTOR_SIZE;
+      else if ((size_t) (*pos % BLOCK_SECTOR_SIZE)
+               >= DIR_BUCKET_ENTRIES * sizeof *e)
+        *pos = ROUND_UP (*pos, BLOCK_SECTOR_SIZE);
+    }
+  if (inode_read_at (inode, e, sizeof *e, *pos) != sizeof *e)
+    return false;
+  *pos += sizeof *e;
+  return true;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, whose parent directory is in PARENT_SECTOR, and
+   adds its "." and ".." entries.  Returns true if successful,
+   false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt,
+            block_sector_t parent_sector)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct dir *dir;
+  bool success;
+
+  dcache_purge (sector);
+  if (!inode_create (sector, entry_cnt * sizeof (struct dir_entry), true))
+    return false;
+
+  dir = dir_open (inode_open (sector));
+  success = (dir != NULL
+             && dir_add (dir, ".", sector)
+             && dir_add (dir, "..", parent_sector));
+  dir_close (dir);
+  return success;
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -76,6 +321,28 @@ dir_close (struct dir *dir)
     }
 }
 
+/* Returns true if NAME is "." or "..". */
+static bool
+is_dot (const char *name)
+{
+  return !strcmp (name, ".") || !strcmp (name, "..");
+}
+
+/* Returns true if DIR has no entries besides "." and "..". */
+static bool
+dir_is_empty (const struct dir *dir)
+{
+  struct dir_header h;
+  struct dir_entry e;
+  bool hashed = dir_read_header (dir, &h);
+  off_t pos = 0;
+
+  while (next_slot (dir->inode, hashed, &pos, &e))
+    if (e.in_use && !is_dot (e.name))
+      return false;
+  return true;
+}
+
 /* Returns the inode encapsulated by DIR. */
 struct inode *
 dir_get_inode (struct dir *dir) 
@@ -92,13 +359,26 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
+  struct dir_header h;
   struct dir_entry e;
-  size_t ofs;
+  off_t ofs, end;
   
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (dir_read_header (dir, &h))
+    {
+      /* Only NAME's bucket can hold it. */
+      ofs = bucket_ofs (&h, name);
+      end = ofs + DIR_BUCKET_ENTRIES * sizeof e;
+    }
+  else
+    {
+      ofs = 0;
+      end = inode_length (dir->inode);
+    }
+
+  for (; ofs < end && inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e) 
     if (e.in_use && !strcmp (name, e.name)) 
       {
@@ -119,19 +399,124 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
+  block_sector_t dir_sector, inode_sector = 0;
   struct dir_entry e;
+  bool found;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
+  if (inode_is_removed (dir->inode))
+    {
+      *inode = NULL;
+      return false;
+    }
+
+  dir_sector = inode_get_inumber (dir->inode);
+  if (!dcache_lookup (dir_sector, name, &found, &inode_sector))
+    {
+      inode_lock_dir (dir->inode);
+      found = lookup (dir, name, &e, NULL);
+      if (found)
+        inode_sector = e.inode_sector;
+      dcache_insert (dir_sector, name, found, inode_sector);
+      inode_unlock_dir (dir->inode);
+    }
+
+  if (found)
+    *inode = inode_open (inode_sector);
   else
     *inode = NULL;
 
   return *inode != NULL;
 }
 
+/* Rewrites DIR in the hashed format with at least BUCKET_CNT
+   buckets, which must be a power of 2, doubling it until every
+   entry fits in its bucket.
+   Returns true if successful, false if memory or disk allocation
+   fails, in which case DIR is left as it was. */
+static bool
+dir_rehash (struct dir *dir, size_t bucket_cnt)
+{
+  struct dir_header h;
+  struct dir_entry e;
+  struct dir_entry *entries = NULL;
+  unsigned *hashes = NULL;
+  size_t *counts = NULL;
+  uint8_t *sector = NULL;
+  size_t entry_cnt, i, b;
+  bool hashed = dir_read_header (dir, &h);
+  bool success = false;
+  off_t pos;
+
+  /* Read every entry in use into memory. */
+  entry_cnt = 0;
+  for (pos = 0; next_slot (dir->inode, hashed, &pos, &e); )
+    if (e.in_use)
+      entry_cnt++;
+  entries = malloc (entry_cnt * sizeof *entries + 1);
+  hashes = malloc (entry_cnt * sizeof *hashes + 1);
+  sector = calloc (1, BLOCK_SECTOR_SIZE);
+  if (entries == NULL || hashes == NULL || sector == NULL)
+    goto done;
+  i = 0;
+  for (pos = 0; i < entry_cnt && next_slot (dir->inode, hashed, &pos, &e); )
+    if (e.in_use)
+      {
+        entries[i] = e;
+        hashes[i] = hash_string (e.name);
+        i++;
+      }
+
+  /* Find a bucket count that no bucket overflows at. */
+  for (;;)
+    {
+      free (counts);
+      counts = calloc (bucket_cnt, sizeof *counts);
+      if (counts == NULL)
+        goto done;
+      for (i = 0; i < entry_cnt; i++)
+        if (++counts[hashes[i] & (bucket_cnt - 1)] > DIR_BUCKET_ENTRIES)
+          break;
+      if (i == entry_cnt)
+        break;
+      bucket_cnt *= 2;
+    }
+
+  /* Write the buckets, growing the directory first so that running
+     out of disk space can't leave it half rewritten. */
+  if (inode_write_at (dir->inode, sector, BLOCK_SECTOR_SIZE,
+                      bucket_cnt * BLOCK_SECTOR_SIZE) != BLOCK_SECTOR_SIZE)
+    goto done;
+  for (b = 0; b < bucket_cnt; b++)
+    {
+      struct dir_entry *slot = (struct dir_entry *) sector;
+
+      memset (sector, 0, BLOCK_SECTOR_SIZE);
+      for (i = 0; i < entry_cnt; i++)
+        if ((hashes[i] & (bucket_cnt - 1)) == b)
+          *slot++ = entries[i];
+      inode_write_at (dir->inode, sector, BLOCK_SECTOR_SIZE,
+                      (b + 1) * BLOCK_SECTOR_SIZE);
+    }
+
+  /* Write the header last. */
+  memset (sector, 0, BLOCK_SECTOR_SIZE);
+  h.magic = DIR_MAGIC;
+  h.bucket_cnt = bucket_cnt;
+  memcpy (sector, &h, sizeof h);
+  inode_write_at (dir->inode, sector, BLOCK_SECTOR_SIZE, 0);
+  success = true;
+
+ done:
+  free (sector);
+  free (counts);
+  free (hashes);
+  free (entries);
+  return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -152,46 +537,101 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  inode_lock_dir (dir->inode);
+
+  /* Nothing can be added to a directory that has been removed. */
+  if (inode_is_removed (dir->inode))
+    goto done;
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  for (;;)
+    {
+      struct dir_header h;
+
+      if (dir_read_header (dir, &h))
+        {
+          /* Set OFS to offset of a free slot in NAME's bucket.
+             If the bucket is full, rehash and try again. */
+          off_t end;
+
+          ofs = bucket_ofs (&h, name);
+          for (end = ofs + DIR_BUCKET_ENTRIES * sizeof e; ofs < end;
+               ofs += sizeof e)
+            if (inode_read_at (dir->inode, &e, sizeof e, ofs) != sizeof e
+                || !e.in_use)
+              break;
+          if (ofs < end)
+            break;
+          if (!dir_rehash (dir, h.bucket_cnt * 2))
+            goto done;
+        }
+      else
+        {
+          bool found = false;
+
+          /* Set OFS to offset of free slot.
+             If there are no free slots, then it will be set to the
+             current end-of-file.
+             
+             inode_read_at() will only return a short read at end of
+             file.  Otherwise, we'd need to verify that we didn't get
+             a short read due to something intermittent such as low
+             memory. */
+          for (ofs = 0;
+               inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+               ofs += sizeof e) 
+            if (!e.in_use)
+              {
+                found = true;
+                break;
+              }
+
+          /* A full flat directory that has grown large is switched
+             over to the hashed format instead of growing further. */
+          if (found || ofs < (off_t) (DIR_FLAT_MAX * sizeof e))
+            break;
+          if (!dir_rehash (dir, DIR_BUCKETS_MIN))
+            goto done;
+        }
+    }
 
   /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
   success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (success)
+    dcache_insert (inode_get_inumber (dir->inode), name, true, inode_sector);
 
  done:
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
 /* Removes any entry for NAME in DIR.
-   Returns true if successful, false on failure,
-   which occurs only if there is no file with the given NAME. */
+   Returns true if successful, false on failure, which occurs if
+   there is no file with the given NAME, if NAME is "." or "..",
+   or if NAME is a directory that isn't empty. */
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
   struct dir_entry e;
   struct inode *inode = NULL;
+  bool is_dir = false;
   bool success = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (is_dot (name))
+    return false;
+
+  inode_lock_dir (dir->inode);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -201,6 +641,23 @@ dir_remove (struct dir *dir, const char *name)
   if (inode == NULL)
     goto done;
 
+  /* Only an empty directory may be removed.  Its lock is held
+     until it is marked removed, so that nothing can be added to
+     it in between. */
+  is_dir = inode_is_dir (inode);
+  if (is_dir)
+    {
+      struct dir *child;
+      bool empty;
+
+      inode_lock_dir (inode);
+      child = dir_open (inode_reopen (inode));
+      empty = child != NULL && dir_is_empty (child);
+      dir_close (child);
+      if (!empty)
+        goto done;
+    }
+
   /* Erase directory entry. */
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
@@ -208,25 +665,30 @@ dir_remove (struct dir *dir, const char *name)
 
   /* Remove inode. */
   inode_remove (inode);
+  dcache_insert (inode_get_inumber (dir->inode), name, false, 0);
   success = true;
 
  done:
+  if (is_dir)
+    inode_unlock_dir (inode);
   inode_close (inode);
+  inode_unlock_dir (dir->inode);
   return success;
 }
 
 /* Reads the next directory entry in DIR and stores the name in
-   NAME.  Returns true if successful, false if the directory
-   contains no more entries. */
+   NAME, skipping "." and "..".  Returns true if successful, false
+   if the directory contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
+  struct dir_header h;
   struct dir_entry e;
+  bool hashed = dir_read_header (dir, &h);
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  while (next_slot (dir->inode, hashed, &dir->pos, &e)) 
     {
-      dir->pos += sizeof e;
-      if (e.in_use)
+      if (e.in_use && !is_dot (e.name))
         {
           strlcpy (name, e.name, NAME_MAX + 1);
           return true;
@@ -1,85 +1,437 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Number of size classes.  Class K holds the free extents whose
+   length is in [2**K, 2**(K+1)). */
+#define FREE_CLASSES 32
+
+/* Most extents examined in the one size class whose extents may
+   or may not be long enough for a request. */
+#define FREE_SCAN_MAX 16
+
+/* Number of free map bits that fit in one sector of its file. */
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* Changes to the free map allowed to accumulate before the
+   sectors of its file that they touched are written back. */
+#define FREE_MAP_BATCH 64
+
+/* A run of free sectors. */
+struct free_extent
+  {
+    block_sector_t start;               /* First sector. */
+    block_sector_t length;              /* Number of sectors. */
+    struct hash_elem start_elem;        /* Element in free_by_start. */
+    struct hash_elem end_elem;          /* Element in free_by_end. */
+    struct list_elem class_elem;        /* Element in free_classes. */
+  };
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects everything here. */
+
+/* Index of the free sectors in free_map, kept as maximal extents.
+   The two hashes find an extent's neighbors when sectors are
+   released, and the size classes find one long enough to
+   allocate from without scanning the bitmap. */
+static struct hash free_by_start;    /* Keyed on first sector. */
+static struct hash free_by_end;      /* Keyed on sector past the end. */
+static struct list free_classes[FREE_CLASSES];
+
+/* Sector just past the last allocation.  Allocations start here
+   when they can, so that a file grown a bit at a time stays
+   contiguous. */
+static block_sector_t free_map_hint;
+
+/* Sectors of free_map_file with changes not yet written, one bit
+   each, and the number of changes since the last write. */
+static struct bitmap *free_map_dirty;
+static size_t free_map_changes;
+
+static void index_build (void);
+static void free_map_flush (void);
+
+/* Returns the size class of an extent of LENGTH sectors. */
+static int
+size_class (block_sector_t length)
+{
+  int k = 0;
+
+  ASSERT (length > 0);
+  while (length >>= 1)
+    k++;
+  return k;
+}
+
+static unsigned
+start_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct free_extent, start_elem)->start);
+}
+
+static bool
+start_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct free_extent, start_elem)->start
+          < hash_entry (b, struct free_extent, start_elem)->start);
+}
+
+static block_sector_t
+extent_end (const struct hash_elem *e)
+{
+  const struct free_extent *x = hash_entry (e, struct free_extent, end_elem);
+  return x->start + x->length;
+}
+
+static unsigned
+end_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (extent_end (e));
+}
+
+static bool
+end_less (const struct hash_elem *a, const struct hash_elem *b,
+          void *aux UNUSED)
+{
+  return extent_end (a) < extent_end (b);
+}
+
+/* Returns the free extent that starts at SECTOR, or a null
+   pointer if there is none. */
+static struct free_extent *
+find_by_start (block_sector_t sector)
+{
+  struct free_extent key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  e = hash_find (&free_by_start, &key.start_elem);
+  return e != NULL ? hash_entry (e, struct free_extent, start_elem) : NULL;
+}
+
+/* Returns the free extent that ends just before SECTOR, or a
+   null pointer if there is none. */
+static struct free_extent *
+find_by_end (block_sector_t sector)
+{
+  struct free_extent key;
+  struct hash_elem *e;
+
+  key.start = sector;
+  key.length = 0;
+  e = hash_find (&free_by_end, &key.end_elem);
+  return e != NULL ? hash_entry (e, struct free_extent, end_elem) : NULL;
+}
+
+/* Adds X to the index. */
+static void
+extent_link (struct free_extent *x)
+{
+  hash_insert (&free_by_start, &x->start_elem);
+  hash_insert (&free_by_end, &x->end_elem);
+  list_push_back (&free_classes[size_class (x->length)], &x->class_elem);
+}
+
+/* Removes X from the index. */
+static void
+extent_unlink (struct free_extent *x)
+{
+  hash_delete (&free_by_start, &x->start_elem);
+  hash_delete (&free_by_end, &x->end_elem);
+  list_remove (&x->class_elem);
+}
+
+/* Frees the free extent in E, which is in free_by_start. */
+static void
+extent_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct free_extent, start_elem));
+}
+
+/* Returns an extent with at least CNT sectors, or a null pointer
+   if none can be found.  Prefers the extent at free_map_hint,
+   then the first extent in the smallest class whose extents are
+   all long enough, and finally looks a short way into the class
+   that holds CNT itself. */
+static struct free_extent *
+extent_find (size_t cnt)
+{
+  struct free_extent *x;
+  struct list_elem *e;
+  int k, i;
+
+  x = find_by_start (free_map_hint);
+  if (x != NULL && x->length >= cnt)
+    return x;
+
+  k = size_class (cnt);
+  for (i = k + ((cnt & (cnt - 1)) != 0); i < FREE_CLASSES; i++)
+    if (!list_empty (&free_classes[i]))
+      return list_entry (list_front (&free_classes[i]),
+                         struct free_extent, class_elem);
+
+  i = 0;
+  for (e = list_begin (&free_classes[k]);
+       e != list_end (&free_classes[k]) && i < FREE_SCAN_MAX;
+       e = list_next (e), i++)
+    {
+      x = list_entry (e, struct free_extent, class_elem);
+      if (x->length >= cnt)
+        return x;
+    }
+  return NULL;
+}
+
+/* Records that the free map bits for the CNT sectors starting
+   at SECTOR changed, and writes the changed parts of the free
+   map back once enough changes have built up. */
+static void
+mark_dirty (block_sector_t sector, size_t cnt)
+{
+  bitmap_set_multiple (free_map_dirty, sector / BITS_PER_SECTOR,
+                       (sector + cnt - 1) / BITS_PER_SECTOR
+                       - sector / BITS_PER_SECTOR + 1, true);
+  if (++free_map_changes >= FREE_MAP_BATCH)
+    free_map_flush ();
+}
+
+/* Writes the sectors of the free map file that have changed.
+   Does nothing until the file exists. */
+static void
+free_map_flush (void)
+{
+  size_t i;
+
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+  if (free_map_file == NULL)
+    return;
+
+  for (i = 0; i < bitmap_size (free_map_dirty); i++)
+    if (bitmap_test (free_map_dirty, i))
+      {
+        size_t start = i * BITS_PER_SECTOR;
+        size_t cnt = bitmap_size (free_map) - start;
+        if (cnt > BITS_PER_SECTOR)
+          cnt = BITS_PER_SECTOR;
+        if (!bitmap_write_range (free_map, free_map_file, start, cnt))
+          PANIC ("can't write free map");
+        bitmap_reset (free_map_dirty, i);
+      }
+  free_map_changes = 0;
+}
 
 /* Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
 {
-  free_map = bitmap_create (block_size (fs_device));
-  if (free_map == NULL)
+  size_t bit_cnt;
+  int i;
+
+  bit_cnt = block_size (fs_device);
+  free_map = bitmap_create (bit_cnt);
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bit_cnt, BITS_PER_SECTOR));
+  if (free_map == NULL || free_map_dirty == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  lock_init (&free_map_lock);
+
+  if (!hash_init (&free_by_start, start_hash, start_less, NULL)
+      || !hash_init (&free_by_end, end_hash, end_less, NULL))
+    PANIC ("free extent index creation failed");
+  for (i = 0; i < FREE_CLASSES; i++)
+    list_init (&free_classes[i]);
+  index_build ();
+}
+
+/* Rebuilds the free extent index from the free map. */
+static void
+index_build (void)
+{
+  size_t pos = 0;
+  size_t start;
+  int i;
+
+  hash_clear (&free_by_end, NULL);
+  hash_clear (&free_by_start, extent_destroy);
+  for (i = 0; i < FREE_CLASSES; i++)
+    list_init (&free_classes[i]);
+  free_map_hint = 0;
+
+  while ((start = bitmap_scan (free_map, pos, 1, false)) != BITMAP_ERROR)
+    {
+      struct free_extent *x;
+      size_t end = bitmap_scan (free_map, start, 1, true);
+      if (end == BITMAP_ERROR)
+        end = bitmap_size (free_map);
+
+      x = malloc (sizeof *x);
+      if (x == NULL)
+        PANIC ("free extent index creation failed");
+      x->start = start;
+      x->length = end - start;
+      extent_link (x);
+      pos = end;
+    }
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  struct free_extent *x;
+  block_sector_t sector;
+
+  ASSERT (cnt > 0);
+
+  lock_acquire (&free_map_lock);
+  x = extent_find (cnt);
+  if (x == NULL)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      lock_release (&free_map_lock);
+      return false;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+
+  /* Take the sectors off the front of X. */
+  sector = x->start;
+  extent_unlink (x);
+  x->start += cnt;
+  x->length -= cnt;
+  if (x->length > 0)
+    extent_link (x);
+  else
+    free (x);
+  free_map_hint = sector + cnt;
+
+  ASSERT (bitmap_none (free_map, sector, cnt));
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+
+  *sectorp = sector;
+  return true;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  struct free_extent *prev, *next;
+
+  /* Cached copies of the sectors must go before anyone else can
+     allocate them. */
+  cache_invalidate (sector, cnt);
+
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+
+  /* Merge with the free extents on either side. */
+  prev = find_by_end (sector);
+  next = find_by_start (sector + cnt);
+  if (prev != NULL)
+    {
+      extent_unlink (prev);
+      prev->length += cnt;
+      if (next != NULL)
+        {
+          extent_unlink (next);
+          prev->length += next->length;
+          free (next);
+        }
+      extent_link (prev);
+    }
+  else if (next != NULL)
+    {
+      extent_unlink (next);
+      next->start = sector;
+      next->length += cnt;
+      extent_link (next);
+    }
+  else
+    {
+      struct free_extent *x = malloc (sizeof *x);
+
+      /* Without memory for a new extent the sectors are still
+         free in the bitmap, just not allocatable until it is
+         read again. */
+      if (x != NULL)
+        {
+          x->start = sector;
+          x->length = cnt;
+          extent_link (x);
+        }
+    }
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
-free_map_open (void) 
+free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
+  lock_acquire (&free_map_lock);
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_dirty, false);
+  free_map_changes = 0;
+  index_build ();
+  lock_release (&free_map_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
-free_map_close (void) 
+free_map_close (void)
 {
-  file_close (free_map_file);
+  struct file *file;
+
+  lock_acquire (&free_map_lock);
+  free_map_flush ();
+  file = free_map_file;
+  free_map_file = NULL;
+  lock_release (&free_map_lock);
+  file_close (file);
 }
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
+  struct file *file;
+
   /* Create inode. */
-  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+  if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map), false))
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
-  free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
-  if (free_map_file == NULL)
+  file = file_open (inode_open (FREE_MAP_SECTOR));
+  if (file == NULL)
     PANIC ("can't open free map");
-  if (!bitmap_write (free_map, free_map_file))
+  lock_acquire (&free_map_lock);
+  bitmap_set_all (free_map_dirty, false);
+  free_map_changes = 0;
+  lock_release (&free_map_lock);
+  if (!bitmap_write (free_map, file))
     PANIC ("can't write free map");
+  lock_acquire (&free_map_lock);
+  free_map_file = file;
+  lock_release (&free_map_lock);
 }
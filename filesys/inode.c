@@ -1,23 +1,50 @@
 #include "filesys/inode.h"
 #include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
-#define INODE_MAGIC 0x494e4f44
+#define INODE_MAGIC 0x494e4f45
+
+/* A run of LENGTH contiguous data sectors starting at START.
+   The sectors of an unwritten extent have been allocated but
+   never written, and read as zeros without going to disk. */
+struct extent
+  {
+    block_sector_t start;               /* First sector of the run. */
+    uint32_t length : 31;               /* Number of sectors. */
+    uint32_t unwritten : 1;             /* Not written yet? */
+  };
+
+/* Number of extents kept in the inode itself, and in its overflow
+   extent block. */
+#define INODE_EXTENTS 61
+#define OVERFLOW_EXTENTS (BLOCK_SECTOR_SIZE / sizeof (struct extent))
+
+/* Most extents an inode can have. */
+#define MAX_EXTENTS (INODE_EXTENTS + OVERFLOW_EXTENTS)
 
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+   A file's data sectors are the runs in EXTENTS, in file order,
+   followed by the runs in the overflow block once the inode's
+   own INODE_EXTENTS are used up. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t sector_cnt;                /* Data sectors allocated. */
+    uint32_t extent_cnt;                /* Extents in use. */
+    block_sector_t overflow;            /* Overflow extent block, if any. */
+    struct extent extents[INODE_EXTENTS]; /* First extents. */
+    uint32_t is_dir;                    /* Nonzero for a directory. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,49 +55,536 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
-/* In-memory inode. */
+/* Read-ahead window bounds, in sectors.  A sequential reader
+   starts out prefetching READAHEAD_MIN sectors past the end of
+   each read, doubling up to READAHEAD_MAX while it stays
+   sequential. */
+#define READAHEAD_MIN 2
+#define READAHEAD_MAX 32
+
+/* Preallocation window bounds, in sectors.  A file that keeps
+   growing at its end allocates that many sectors past what the
+   write needs, doubling from PREALLOC_MIN up to PREALLOC_MAX
+   while it keeps appending.  Whatever is left unused is given
+   back when the file is closed. */
+#define PREALLOC_MIN 8
+#define PREALLOC_MAX 128
+
+/* A sector's worth of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Number of buckets in the open inode table.  Must be a power
+   of 2. */
+#define INODE_BUCKETS 64
+
+/* In-memory inode.
+   SECTOR and OPEN_CNT are protected by the lock of the open inode
+   table bucket the inode is in; everything else by LOCK.
+   DIR_LOCK protects nothing here: the directory layer holds it
+   across each lookup, addition and removal in a directory.  It
+   is acquired before LOCK, and a directory's before those of the
+   directories in it, never the other way around. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct list_elem elem;              /* Element in inode table bucket. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    struct lock dir_lock;               /* Serializes directory changes. */
+    struct lock lock;                   /* Protects the members below. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t ra_pos;                       /* Where a sequential read resumes. */
+    off_t ra_end;                       /* End of data already prefetched. */
+    size_t ra_window;                   /* Read-ahead window in sectors. */
+    size_t ext_idx;                     /* Extent last found by lookup. */
+    size_t ext_first;                   /* Its first sector in the file. */
+    size_t prealloc_window;             /* Growth window in sectors. */
+    bool dirty;                         /* DATA changed since written? */
+    struct list_elem dirty_elem;        /* Element in dirty inode list. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* A bucket of the open inode table.  Its lock protects the list
+   and the open counts of the inodes on it, and is held while an
+   inode is read in or torn down, so nobody can open a sector
+   while its last opener is still writing it back. */
+struct inode_bucket
+  {
+    struct lock lock;
+    struct list inodes;
+  };
+
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct inode_bucket open_inodes[INODE_BUCKETS];
+
+/* Open inodes whose disk inode has changed since it was last
+   written to the buffer cache, protected by dirty_lock.  An
+   inode's lock is acquired before dirty_lock, never after. */
+static struct list dirty_inodes;
+static struct lock dirty_lock;
+
+/* Returns the open inode table bucket for SECTOR. */
+static inline struct inode_bucket *
+inode_bucket (block_sector_t sector)
+{
+  return &open_inodes[hash_int (sector) & (INODE_BUCKETS - 1)];
+}
+
+/* Returns the inode for SECTOR if it is open, or a null pointer.
+   The caller must hold B's lock. */
+static struct inode *
+inode_lookup (struct inode_bucket *b, block_sector_t sector)
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&b->lock));
+
+  for (e = list_begin (&b->inodes); e != list_end (&b->inodes);
+       e = list_next (e)) 
+    {
+      struct inode *inode = list_entry (e, struct inode, elem);
+      if (inode->sector == sector) 
+        return inode;
+    }
+  return NULL;
+}
+
+/* Stores extent IDX of DISK_INODE in *E. */
+static void
+extent_read (const struct inode_disk *disk_inode, size_t idx,
+             struct extent *e)
+{
+  ASSERT (idx < disk_inode->extent_cnt);
+
+  if (idx < INODE_EXTENTS)
+    *e = disk_inode->extents[idx];
+  else
+    cache_read (NULL, disk_inode->overflow, e,
+                (idx - INODE_EXTENTS) * sizeof *e, sizeof *e);
+}
+
+/* Sets extent IDX of DISK_INODE to *E, allocating the overflow
+   extent block if this is the first extent to go there.
+   Returns false if the overflow block is full or can't be
+   allocated. */
+static bool
+extent_write (struct inode_disk *disk_inode, size_t idx,
+              const struct extent *e)
+{
+  if (idx < INODE_EXTENTS)
+    {
+      disk_inode->extents[idx] = *e;
+      return true;
+    }
+  if (idx >= MAX_EXTENTS)
+    return false;
+  if (idx == INODE_EXTENTS && idx == disk_inode->extent_cnt
+      && !free_map_allocate (1, &disk_inode->overflow))
+    return false;
+  cache_write (NULL, disk_inode->overflow, e,
+               (idx - INODE_EXTENTS) * sizeof *e, sizeof *e);
+  return true;
+}
+
+/* Inserts *E as extent IDX of DISK_INODE, moving the extents
+   from IDX onward up by one.
+   Returns false, without changing anything, if there is no room
+   for another extent. */
+static bool
+extent_insert (struct inode_disk *disk_inode, size_t idx,
+               const struct extent *e)
+{
+  struct extent tmp;
+  size_t i;
+
+  ASSERT (idx <= disk_inode->extent_cnt);
+
+  for (i = disk_inode->extent_cnt; i > idx; i--)
+    {
+      extent_read (disk_inode, i - 1, &tmp);
+      if (!extent_write (disk_inode, i, &tmp))
+        return false;
+    }
+  if (!extent_write (disk_inode, idx, e))
+    return false;
+  disk_inode->extent_cnt++;
+  return true;
+}
+
+/* Removes extent IDX from DISK_INODE, moving the extents after it
+   down by one, and releases the overflow extent block once it is
+   no longer needed.  Doesn't release the extent's sectors. */
+static void
+extent_remove (struct inode_disk *disk_inode, size_t idx)
+{
+  struct extent tmp;
+  size_t i;
+
+  ASSERT (idx < disk_inode->extent_cnt);
+
+  for (i = idx + 1; i < disk_inode->extent_cnt; i++)
+    {
+      extent_read (disk_inode, i, &tmp);
+      extent_write (disk_inode, i - 1, &tmp);
+    }
+  if (--disk_inode->extent_cnt == INODE_EXTENTS)
+    free_map_release (disk_inode->overflow, 1);
+}
+
+/* Appends the CNT sectors starting at START to the end of
+   DISK_INODE's data as an unwritten extent, merging them into
+   the last extent if it is also unwritten and they follow on
+   from it.
+   Returns false if a new extent was needed but there is no room
+   for one. */
+static bool
+extent_append (struct inode_disk *disk_inode, block_sector_t start,
+               size_t cnt)
+{
+  struct extent e;
+
+  if (disk_inode->extent_cnt > 0)
+    {
+      size_t last = disk_inode->extent_cnt - 1;
+      extent_read (disk_inode, last, &e);
+      if (e.unwritten && e.start + e.length == start)
+        {
+          e.length += cnt;
+          extent_write (disk_inode, last, &e);
+          disk_inode->sector_cnt += cnt;
+          return true;
+        }
+    }
+
+  e.start = start;
+  e.length = cnt;
+  e.unwritten = true;
+  if (!extent_write (disk_inode, disk_inode->extent_cnt, &e))
+    return false;
+  disk_inode->extent_cnt++;
+  disk_inode->sector_cnt += cnt;
+  return true;
+}
+
+/* Allocates CNT more data sectors for DISK_INODE, in as few runs
+   as the free map allows: all at once if possible, and otherwise
+   in runs of half the size, then a quarter, and so on.  The new
+   sectors are unwritten, so they read as zeros but nothing is
+   written to disk for them until the file is.
+   Returns false if the disk is full or the inode runs out of
+   extents, in which case the sectors allocated so far stay
+   attached to DISK_INODE. */
+static bool
+extents_allocate (struct inode_disk *disk_inode, size_t cnt)
+{
+  size_t run = cnt;
+
+  while (cnt > 0)
+    {
+      block_sector_t start;
+
+      if (run > cnt)
+        run = cnt;
+      if (!free_map_allocate (run, &start))
+        {
+          if (run == 1)
+            return false;
+          run /= 2;
+          continue;
+        }
+      if (!extent_append (disk_inode, start, run))
+        {
+          free_map_release (start, run);
+          return false;
+        }
+      cnt -= run;
+    }
+  return true;
+}
+
+/* Releases all of DISK_INODE's data sectors and its overflow
+   extent block. */
+static void
+extents_release (struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  for (i = 0; i < disk_inode->extent_cnt; i++)
+    {
+      struct extent e;
+      extent_read (disk_inode, i, &e);
+      free_map_release (e.start, e.length);
+    }
+  if (disk_inode->extent_cnt > INODE_EXTENTS)
+    free_map_release (disk_inode->overflow, 1);
+  disk_inode->extent_cnt = 0;
+  disk_inode->sector_cnt = 0;
+}
+
+/* Shrinks DISK_INODE's data to its first KEEP sectors, releasing
+   the rest, and the overflow extent block if it is no longer
+   needed. */
+static void
+extents_truncate (struct inode_disk *disk_inode, size_t keep)
+{
+  while (disk_inode->sector_cnt > keep)
+    {
+      size_t last = disk_inode->extent_cnt - 1;
+      size_t excess = disk_inode->sector_cnt - keep;
+      struct extent e;
+
+      extent_read (disk_inode, last, &e);
+      if (excess < e.length)
+        {
+          e.length -= excess;
+          free_map_release (e.start + e.length, excess);
+          extent_write (disk_inode, last, &e);
+          disk_inode->sector_cnt -= excess;
+        }
+      else
+        {
+          free_map_release (e.start, e.length);
+          extent_remove (disk_inode, last);
+          disk_inode->sector_cnt -= e.length;
+        }
+    }
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, and sets *UNWRITTEN, if UNWRITTEN is nonnull, to
+   whether that sector is still unwritten.
    Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   POS.
+   The search starts from the extent the last lookup ended in, so
+   reading a file from front to back doesn't rescan its
+   extents. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) 
+byte_to_sector (struct inode *inode, off_t pos, bool *unwritten) 
 {
+  size_t sector;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  if (pos >= inode->data.length)
     return -1;
+
+  sector = pos / BLOCK_SECTOR_SIZE;
+  if (sector < inode->ext_first)
+    {
+      inode->ext_idx = 0;
+      inode->ext_first = 0;
+    }
+  while (inode->ext_idx < inode->data.extent_cnt)
+    {
+      struct extent e;
+      extent_read (&inode->data, inode->ext_idx, &e);
+      if (sector < inode->ext_first + e.length)
+        {
+          if (unwritten != NULL)
+            *unwritten = e.unwritten;
+          return e.start + (sector - inode->ext_first);
+        }
+      inode->ext_first += e.length;
+      inode->ext_idx++;
+    }
+  NOT_REACHED ();
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Marks INODE's in-memory disk inode as changed, to be written
+   back by inode_writeback().  The caller must hold INODE's lock,
+   or be its last opener. */
+static void
+inode_mark_dirty (struct inode *inode)
+{
+  if (!inode->dirty)
+    {
+      inode->dirty = true;
+      lock_acquire (&dirty_lock);
+      list_push_back (&dirty_inodes, &inode->dirty_elem);
+      lock_release (&dirty_lock);
+    }
+}
+
+/* Takes INODE off the dirty inode list, without writing it. */
+static void
+inode_mark_clean (struct inode *inode)
+{
+  if (inode->dirty)
+    {
+      inode->dirty = false;
+      lock_acquire (&dirty_lock);
+      list_remove (&inode->dirty_elem);
+      lock_release (&dirty_lock);
+    }
+}
+
+/* Writes INODE's disk inode to the buffer cache if it changed.
+   The caller must hold INODE's lock, or be its last opener. */
+static void
+inode_writeback (struct inode *inode)
+{
+  if (inode->dirty)
+    {
+      cache_write (NULL, inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+      inode_mark_clean (inode);
+    }
+}
+
+/* Turns the unwritten data sector at byte offset POS in INODE into
+   a written one, which the caller must already have written in
+   full.  A byte_to_sector() lookup of POS must have just
+   returned, so that INODE's extent hint points at the extent that
+   holds POS.  The sector is split off into an extent of its own,
+   or merged into a written extent next to it; if there's no room
+   for the new extents, the whole extent is zeroed instead. */
+static void
+extent_convert (struct inode *inode, off_t pos)
+{
+  struct inode_disk *data = &inode->data;
+  size_t idx = inode->ext_idx;
+  size_t k = pos / BLOCK_SECTOR_SIZE - inode->ext_first;
+  struct extent e, w, prev;
+  bool merge_prev = false;
+
+  extent_read (data, idx, &e);
+  ASSERT (e.unwritten && k < e.length);
+
+  if (k == 0 && idx > 0)
+    {
+      extent_read (data, idx - 1, &prev);
+      merge_prev = !prev.unwritten && prev.start + prev.length == e.start;
+    }
+
+  w.start = e.start + k;
+  w.length = 1;
+  w.unwritten = false;
+
+  if (e.length == 1)
+    {
+      /* Nothing left unwritten. */
+      extent_write (data, idx, &w);
+    }
+  else if (merge_prev)
+    {
+      /* Move the first sector over to the written extent before. */
+      prev.length++;
+      e.start++;
+      e.length--;
+      extent_write (data, idx - 1, &prev);
+      extent_write (data, idx, &e);
+    }
+  else if (k == 0)
+    {
+      e.start++;
+      e.length--;
+      if (!extent_insert (data, idx, &w))
+        goto zero_fill;
+      extent_write (data, idx + 1, &e);
+    }
+  else if (k == e.length - 1u)
+    {
+      e.length--;
+      if (!extent_insert (data, idx + 1, &w))
+        goto zero_fill;
+      extent_write (data, idx, &e);
+    }
+  else
+    {
+      struct extent tail;
+
+      tail.start = w.start + 1;
+      tail.length = e.length - k - 1;
+      tail.unwritten = true;
+      e.length = k;
+      if (data->extent_cnt + 2 > MAX_EXTENTS
+          || !extent_insert (data, idx + 1, &tail))
+        goto zero_fill;
+      if (!extent_insert (data, idx + 1, &w))
+        {
+          extent_remove (data, idx + 1);
+          goto zero_fill;
+        }
+      extent_write (data, idx, &e);
+    }
+  goto done;
+
+ zero_fill:
+  {
+    size_t i;
+
+    extent_read (data, idx, &e);
+    for (i = 0; i < e.length; i++)
+      if (e.start + i != w.start)
+        cache_write (inode, e.start + i, zeros, 0, BLOCK_SECTOR_SIZE);
+    e.unwritten = false;
+    extent_write (data, idx, &e);
+  }
+
+ done:
+  /* Extents may have moved, so start the next lookup over. */
+  inode->ext_idx = 0;
+  inode->ext_first = 0;
+  inode_mark_dirty (inode);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  size_t i;
+
+  for (i = 0; i < INODE_BUCKETS; i++)
+    {
+      lock_init (&open_inodes[i].lock);
+      list_init (&open_inodes[i].inodes);
+    }
+  list_init (&dirty_inodes);
+  lock_init (&dirty_lock);
+}
+
+/* Writes every changed disk inode back to the buffer cache. */
+void
+inode_flush (void)
+{
+  for (;;)
+    {
+      struct inode_bucket *b;
+      struct inode *inode;
+      block_sector_t sector;
+
+      lock_acquire (&dirty_lock);
+      if (list_empty (&dirty_inodes))
+        {
+          lock_release (&dirty_lock);
+          break;
+        }
+      sector = list_entry (list_front (&dirty_inodes),
+                           struct inode, dirty_elem)->sector;
+      lock_release (&dirty_lock);
+
+      /* The inode may have been closed in the meantime, but a
+         dirty inode is always in the table, so looking it up
+         again under its bucket lock is safe. */
+      b = inode_bucket (sector);
+      lock_acquire (&b->lock);
+      inode = inode_lookup (b, sector);
+      if (inode != NULL)
+        {
+          lock_acquire (&inode->lock);
+          inode_writeback (inode);
+          lock_release (&inode->lock);
+        }
+      lock_release (&b->lock);
+    }
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The inode is a directory if IS_DIR is true.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
-inode_create (block_sector_t sector, off_t length)
+inode_create (block_sector_t sector, off_t length, bool is_dir)
 {
   struct inode_disk *disk_inode = NULL;
   bool success = false;
@@ -87,19 +601,14 @@ inode_create (block_sector_t sector, off_t length)
       size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      disk_inode->is_dir = is_dir;
+      if (extents_allocate (disk_inode, sectors)) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          cache_write (NULL, sector, disk_inode, 0, BLOCK_SECTOR_SIZE);
           success = true; 
         } 
+      else
+        extents_release (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -111,33 +620,45 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode_bucket *b = inode_bucket (sector);
   struct inode *inode;
 
+  lock_acquire (&b->lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  inode = inode_lookup (b, sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      inode->open_cnt++;
+      lock_release (&b->lock);
+      return inode; 
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&b->lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  list_push_front (&b->inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
+  lock_init (&inode->dir_lock);
+  lock_init (&inode->lock);
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  inode->ra_pos = 0;
+  inode->ra_end = 0;
+  inode->ra_window = 0;
+  inode->ext_idx = 0;
+  inode->ext_first = 0;
+  inode->prealloc_window = 0;
+  inode->dirty = false;
+  cache_read (inode, inode->sector, &inode->data, 0, BLOCK_SECTOR_SIZE);
+  lock_release (&b->lock);
   return inode;
 }
 
@@ -146,7 +667,12 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      struct inode_bucket *b = inode_bucket (inode->sector);
+      lock_acquire (&b->lock);
+      inode->open_cnt++;
+      lock_release (&b->lock);
+    }
   return inode;
 }
 
@@ -163,26 +689,47 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  struct inode_bucket *b;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  b = inode_bucket (inode->sector);
+  lock_acquire (&b->lock);
+
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
+      /* Remove from inode table.  Keep the bucket locked until the
+         inode is written back, so that a new opener of the same
+         sector reads what we write. */
       list_remove (&inode->elem);
  
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          extents_release (&inode->data);
+          inode_mark_clean (inode);
+        }
+      else
+        {
+          /* Give back what's left of the preallocation window. */
+          if (inode->data.sector_cnt > bytes_to_sectors (inode->data.length))
+            {
+              extents_truncate (&inode->data,
+                                bytes_to_sectors (inode->data.length));
+              inode_mark_dirty (inode);
+            }
+          inode_writeback (inode);
         }
+      lock_release (&b->lock);
 
       free (inode); 
     }
+  else
+    lock_release (&b->lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -191,84 +738,172 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inode->lock);
   inode->removed = true;
+  lock_release (&inode->lock);
+}
+
+/* Prefetches the part of INODE's read-ahead window that lies
+   past the data already requested, given that a read just ended
+   at byte offset POS. */
+static void
+inode_readahead (struct inode *inode, off_t pos)
+{
+  off_t length = inode_length (inode);
+  off_t end = pos + (off_t) inode->ra_window * BLOCK_SECTOR_SIZE;
+  off_t ofs;
+
+  if (end > length)
+    end = length;
+  ofs = inode->ra_end > pos ? inode->ra_end : pos;
+  ofs = ofs / BLOCK_SECTOR_SIZE * BLOCK_SECTOR_SIZE;
+  for (; ofs < end; ofs += BLOCK_SECTOR_SIZE)
+    {
+      bool unwritten;
+      block_sector_t sector_idx = byte_to_sector (inode, ofs, &unwritten);
+      if (!unwritten)
+        cache_readahead (sector_idx);
+    }
+  if (end > inode->ra_end)
+    inode->ra_end = end;
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
-   than SIZE if an error occurs or end of file is reached. */
+   than SIZE if an error occurs or end of file is reached.
+   A read that starts where the last one ended grows INODE's
+   read-ahead window and prefetches that far past its end; any
+   other read shuts read-ahead off again. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+
+  lock_acquire (&inode->lock);
+  if (offset == inode->ra_pos && offset > 0)
+    {
+      if (inode->ra_window == 0)
+        inode->ra_window = READAHEAD_MIN;
+      else if (inode->ra_window < READAHEAD_MAX)
+        inode->ra_window *= 2;
+    }
+  else
+    {
+      inode->ra_window = 0;
+      inode->ra_end = 0;
+    }
+  lock_release (&inode->lock);
 
   while (size > 0) 
     {
-      /* Disk sector to read, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
-      int sector_ofs = offset % BLOCK_SECTOR_SIZE;
+      bool unwritten;
+      block_sector_t sector_idx;
+      int sector_ofs, sector_left, min_left, chunk_size;
+      off_t inode_left;
+
+      /* Disk sector to read, starting byte offset within sector.
+         Only the lookup needs INODE's lock; the copy doesn't. */
+      lock_acquire (&inode->lock);
+      sector_idx = byte_to_sector (inode, offset, &unwritten);
+      inode_left = inode->data.length - offset;
+      lock_release (&inode->lock);
+      sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
-      int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
+      min_left = inode_left < sector_left ? inode_left : sector_left;
 
       /* Number of bytes to actually copy out of this sector. */
-      int chunk_size = size < min_left ? size : min_left;
+      chunk_size = size < min_left ? size : min_left;
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      if (unwritten)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
+        cache_read (inode, sector_idx, buffer + bytes_read, sector_ofs,
+                    chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+
+  lock_acquire (&inode->lock);
+  inode->ra_pos = offset;
+  if (inode->ra_window > 0)
+    inode_readahead (inode, offset);
+  lock_release (&inode->lock);
 
   return bytes_read;
 }
 
+/* Extends INODE to LENGTH bytes, allocating data sectors for it
+   if needed.  A file that is being appended to allocates a batch
+   of extra sectors past LENGTH, so that the next few appends need
+   no allocation and the file stays contiguous.  The bytes between
+   the old and new lengths read as zeros.  The new length reaches
+   disk when the inode is written back.
+   If the disk fills up, extends INODE only as far as the sectors
+   it got allow. */
+static void
+inode_grow (struct inode *inode, off_t length, bool append)
+{
+  struct inode_disk *data = &inode->data;
+  size_t need = bytes_to_sectors (length);
+
+  if (need > data->sector_cnt)
+    {
+      if (!append)
+        inode->prealloc_window = 0;
+      else if (inode->prealloc_window == 0)
+        inode->prealloc_window = PREALLOC_MIN;
+      else if (inode->prealloc_window < PREALLOC_MAX)
+        inode->prealloc_window *= 2;
+
+      if (!extents_allocate (data, need - data->sector_cnt
+                                   + inode->prealloc_window)
+          && data->sector_cnt < need)
+        length = (off_t) data->sector_cnt * BLOCK_SECTOR_SIZE;
+      inode_mark_dirty (inode);
+    }
+
+  if (length > data->length)
+    {
+      data->length = length;
+      inode_mark_dirty (inode);
+    }
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   A write past end of file extends the inode.
+   Writes to the same inode are serialized by its lock. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
+  lock_acquire (&inode->lock);
   if (inode->deny_write_cnt)
-    return 0;
+    {
+      lock_release (&inode->lock);
+      return 0;
+    }
+
+  if (size > 0 && offset + size > inode_length (inode))
+    inode_grow (inode, offset + size, offset == inode_length (inode));
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      bool unwritten;
+      block_sector_t sector_idx = byte_to_sector (inode, offset, &unwritten);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -281,38 +916,22 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
-        }
+      /* The first write to a sector zeroes whatever of it this
+         write won't cover, and then makes it part of a written
+         extent.  Until then, readers keep seeing zeros. */
+      if (unwritten && chunk_size < BLOCK_SECTOR_SIZE)
+        cache_write (inode, sector_idx, zeros, 0, BLOCK_SECTOR_SIZE);
+      cache_write (inode, sector_idx, buffer + bytes_written, sector_ofs,
+                   chunk_size);
+      if (unwritten)
+        extent_convert (inode, offset);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
+  lock_release (&inode->lock);
 
   return bytes_written;
 }
@@ -322,8 +941,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,9 +953,41 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  lock_acquire (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  lock_release (&inode->lock);
+}
+
+/* Acquires the directory lock of INODE, which must be a
+   directory. */
+void
+inode_lock_dir (struct inode *inode)
+{
+  ASSERT (inode_is_dir (inode));
+  lock_acquire (&inode->dir_lock);
+}
+
+/* Releases the directory lock of INODE. */
+void
+inode_unlock_dir (struct inode *inode)
+{
+  lock_release (&inode->dir_lock);
+}
+
+/* Returns true if INODE is a directory. */
+bool
+inode_is_dir (const struct inode *inode)
+{
+  return inode->data.is_dir != 0;
+}
+
+/* Returns true if INODE has been removed. */
+bool
+inode_is_removed (const struct inode *inode)
+{
+  return inode->removed;
 }
 
 /* Returns the length, in bytes, of INODE's data. */
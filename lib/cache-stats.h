@@ -0,0 +1,19 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+#include <stdint.h>
+
+/* Buffer cache counters, as reported by the cachestat system
+   call.  Shared between the kernel and user programs. */
+struct cache_stats
+  {
+    uint64_t hits;              /* Lookups that found the sector cached. */
+    uint64_t misses;            /* Lookups that had to fill a slot. */
+    uint64_t evictions;         /* Slots taken back from another sector. */
+    uint64_t writebacks;        /* Dirty blocks written back to disk. */
+    uint64_t readaheads;        /* Sectors brought in by read-ahead. */
+    uint64_t readahead_hits;    /* Read-ahead sectors later looked up. */
+    int64_t io_wait_ticks;      /* Timer ticks lookups spent blocked. */
+  };
+
+#endif /* lib/cache-stats.h */
@@ -0,0 +1,18 @@
+#ifndef __LIB_IOVEC_H
+#define __LIB_IOVEC_H
+
+#include <stddef.h>
+
+/* One buffer of a vectored read or write, as passed to the
+   readv and writev system calls.  Shared between the kernel and
+   user programs. */
+struct iovec
+  {
+    void *iov_base;             /* Start of the buffer. */
+    size_t iov_len;             /* Length of the buffer in bytes. */
+  };
+
+/* Most buffers a single readv or writev may name. */
+#define IOV_MAX 16
+
+#endif /* lib/iovec.h */
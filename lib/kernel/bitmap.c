@@ -69,6 +69,73 @@ last_mask (const struct bitmap *b)
   return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
 
+/* Returns element IDX of B, complemented if VALUE is false, so
+   that the bits set to 1 in the result are those set to VALUE in
+   B.  Bits past the end of B are always 0 in the result. */
+static inline elem_type
+elem_value (const struct bitmap *b, size_t idx, bool value)
+{
+  elem_type e = value ? b->bits[idx] : ~b->bits[idx];
+  if (idx == elem_cnt (b->bit_cnt) - 1)
+    e &= last_mask (b);
+  return e;
+}
+
+/* Returns a mask of the CNT bits starting at bit OFS of an
+   element.  OFS + CNT must not exceed ELEM_BITS. */
+static inline elem_type
+range_mask (size_t ofs, size_t cnt)
+{
+  elem_type m = cnt < ELEM_BITS ? ((elem_type) 1 << cnt) - 1 : (elem_type) -1;
+  return m << ofs;
+}
+
+/* Returns the number of bits from I up to END, exclusive, that
+   lie in the same element as bit I. */
+static inline size_t
+chunk_len (size_t i, size_t end)
+{
+  size_t n = ELEM_BITS - i % ELEM_BITS;
+  return n < end - i ? n : end - i;
+}
+
+/* Returns the number of bits set to 1 in E, which like every
+   unsigned long on the 80x86 is 32 bits wide.  (GCC's
+   __builtin_popcount() would call into libgcc, which the kernel
+   does not link against.) */
+static inline size_t
+popcount (elem_type e)
+{
+  e = e - ((e >> 1) & 0x55555555);
+  e = (e & 0x33333333) + ((e >> 2) & 0x33333333);
+  e = (e + (e >> 4)) & 0x0f0f0f0f;
+  return (e * 0x01010101) >> 24;
+}
+
+/* Returns the index of the first bit in B at or after START
+   that is set to VALUE, or B's size if there is none.  Skips
+   over whole elements that hold no such bit. */
+static size_t
+next_value (const struct bitmap *b, size_t start, bool value)
+{
+  size_t idx, last;
+  elem_type e;
+
+  if (start >= b->bit_cnt)
+    return b->bit_cnt;
+
+  idx = elem_idx (start);
+  last = elem_cnt (b->bit_cnt) - 1;
+  e = elem_value (b, idx, value) & ((elem_type) -1 << (start % ELEM_BITS));
+  while (e == 0)
+    {
+      if (idx == last)
+        return b->bit_cnt;
+      e = elem_value (b, ++idx, value);
+    }
+  return idx * ELEM_BITS + __builtin_ctzl (e);
+}
+
 /* Creation and destruction. */
 
 /* Initializes B to be a bitmap of BIT_CNT bits
@@ -224,8 +291,21 @@ bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    bitmap_set (b, start + i, value);
+  /* A whole element at a time, each one atomically as in
+     bitmap_mark() and bitmap_reset(). */
+  for (i = start; i < start + cnt; )
+    {
+      size_t idx = elem_idx (i);
+      size_t ofs = i % ELEM_BITS;
+      size_t n = chunk_len (i, start + cnt);
+      elem_type mask = range_mask (ofs, n);
+
+      if (value)
+        asm ("orl %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+      else
+        asm ("andl %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+      i += n;
+    }
 }
 
 /* Returns the number of bits in B between START and START + CNT,
@@ -240,9 +320,14 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start + cnt <= b->bit_cnt);
 
   value_cnt = 0;
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      value_cnt++;
+  for (i = start; i < start + cnt; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = chunk_len (i, start + cnt);
+      value_cnt += popcount (elem_value (b, elem_idx (i), value)
+                             & range_mask (ofs, n));
+      i += n;
+    }
   return value_cnt;
 }
 
@@ -257,9 +342,14 @@ bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value)
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
-      return true;
+  for (i = start; i < start + cnt; )
+    {
+      size_t ofs = i % ELEM_BITS;
+      size_t n = chunk_len (i, start + cnt);
+      if (elem_value (b, elem_idx (i), value) & range_mask (ofs, n))
+        return true;
+      i += n;
+    }
   return false;
 }
 
@@ -302,10 +392,21 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
   if (cnt <= b->bit_cnt) 
     {
       size_t last = b->bit_cnt - cnt;
-      size_t i;
-      for (i = start; i <= last; i++)
-        if (!bitmap_contains (b, i, cnt, !value))
-          return i; 
+      size_t i = start;
+
+      if (cnt == 0)
+        return i;
+
+      /* Each candidate run starts at a bit set to VALUE and ends
+         at the next bit that is not, so every element is looked
+         at no more than twice. */
+      while ((i = next_value (b, i, value)) <= last)
+        {
+          size_t end = next_value (b, i, !value);
+          if (end - i >= cnt)
+            return i;
+          i = end;
+        }
     }
   return BITMAP_ERROR;
 }
@@ -359,6 +460,26 @@ bitmap_write (const struct bitmap *b, struct file *file)
   off_t size = byte_cnt (b->bit_cnt);
   return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the bytes of B that hold the CNT bits starting at START
+   to the same position in FILE, which must have been written in
+   full by bitmap_write().  START must be a multiple of CHAR_BIT.
+   Return true if successful, false otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file,
+                    size_t start, size_t cnt)
+{
+  off_t ofs, size;
+
+  ASSERT (start % CHAR_BIT == 0);
+  ASSERT (start <= b->bit_cnt);
+  ASSERT (cnt <= b->bit_cnt - start);
+
+  ofs = start / CHAR_BIT;
+  size = byte_cnt (start + cnt) - ofs;
+  return (file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+          == size);
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -1,14 +1,19 @@
 #include <console.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/serial.h"
 #include "devices/vga.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 static void vprintf_helper (char, void *);
 static void putchar_have_lock (uint8_t c);
+static void putbuf_have_lock (const uint8_t *buffer, size_t n);
+static void emit (uint8_t c);
+static thread_func drain;
 
 /* The console lock.
    Both the vga and serial layers do their own locking, so it's
@@ -59,6 +64,31 @@ static int console_lock_depth;
 /* Number of characters written to console. */
 static int64_t write_cnt;
 
+/* Size of the console output buffer. */
+#define BUF_SIZE 4096
+
+/* Console output waiting for the drain thread, as a ring buffer.
+   Bytes are added at HEAD and removed at TAIL.  Both only ever
+   grow, so HEAD - TAIL is the number of bytes waiting.
+   Interrupts must be off to access the buffer or the thread
+   pointers below. */
+static uint8_t buf[BUF_SIZE];
+static size_t head, tail;
+
+/* True while output goes through the buffer, false before
+   console_init_queue() and after console_flush(). */
+static bool buffered;
+
+/* The drain thread, and whether it is blocked waiting for
+   output. */
+static struct thread *drainer;
+static bool drainer_idle;
+
+/* A thread waiting for room in the buffer, and a thread waiting
+   in console_flush() for the buffer to empty, or null pointers. */
+static struct thread *writer;
+static struct thread *flusher;
+
 /* Enable console locking. */
 void
 console_init (void) 
@@ -67,6 +97,19 @@ console_init (void)
   use_console_lock = true;
 }
 
+/* Starts buffering console output.  From now on, writers copy
+   their output into a buffer and a dedicated thread sends it to
+   the serial port and vga display, so that writing to the
+   console only waits for the serial port when the buffer is
+   full.  Must be called after serial_init_queue(). */
+void
+console_init_queue (void) 
+{
+  ASSERT (!buffered);
+  if (thread_create ("console", PRI_DEFAULT, drain, NULL) == TID_ERROR)
+    PANIC ("couldn't start console thread");
+}
+
 /* Notifies the console that a kernel panic is underway,
    which warns it to avoid trying to take the console lock from
    now on. */
@@ -74,6 +117,31 @@ void
 console_panic (void) 
 {
   use_console_lock = false;
+  console_flush ();
+}
+
+/* Writes out all buffered console output and stops buffering,
+   so that later output goes straight to the devices.  Called
+   before powering off, and on panic. */
+void
+console_flush (void) 
+{
+  enum intr_level old_level = intr_disable ();
+
+  /* Let the drain thread finish, including the byte it may be
+     sending right now, unless we cannot sleep. */
+  if (buffered && !intr_context () && old_level == INTR_ON)
+    while (head != tail || !drainer_idle)
+      {
+        ASSERT (flusher == NULL);
+        flusher = thread_current ();
+        thread_block ();
+      }
+
+  buffered = false;
+  while (head != tail)
+    emit (buf[tail++ % BUF_SIZE]);
+  intr_set_level (old_level);
 }
 
 /* Prints console statistics. */
@@ -153,8 +221,7 @@ void
 putbuf (const char *buffer, size_t n) 
 {
   acquire_console ();
-  while (n-- > 0)
-    putchar_have_lock (*buffer++);
+  putbuf_have_lock ((const uint8_t *) buffer, n);
   release_console ();
 }
 
@@ -184,8 +251,108 @@ vprintf_helper (char c, void *char_cnt_)
 static void
 putchar_have_lock (uint8_t c) 
 {
+  putbuf_have_lock (&c, 1);
+}
+
+/* Writes the N bytes in BUFFER to the vga display and serial
+   port, through the output buffer if it is in use.
+   The caller has already acquired the console lock if
+   appropriate. */
+static void
+putbuf_have_lock (const uint8_t *buffer, size_t n) 
+{
+  enum intr_level old_level;
+
   ASSERT (console_locked_by_current_thread ());
-  write_cnt++;
+  write_cnt += n;
+
+  old_level = intr_disable ();
+  while (n > 0 && buffered) 
+    {
+      size_t ofs = head % BUF_SIZE;
+      size_t room = BUF_SIZE - (head - tail);
+      size_t chunk;
+
+      if (room == 0)
+        {
+          if (intr_context () || old_level == INTR_OFF)
+            {
+              /* We can't sleep, so make room by sending the
+                 oldest byte ourselves.  It may overtake a byte
+                 the drain thread is about to send. */
+              emit (buf[tail++ % BUF_SIZE]);
+            }
+          else 
+            {
+              ASSERT (writer == NULL);
+              writer = thread_current ();
+              thread_block ();
+            }
+          continue;
+        }
+
+      chunk = n < room ? n : room;
+      if (chunk > BUF_SIZE - ofs)
+        chunk = BUF_SIZE - ofs;
+      memcpy (buf + ofs, buffer, chunk);
+      head += chunk;
+      buffer += chunk;
+      n -= chunk;
+
+      if (drainer_idle) 
+        {
+          drainer_idle = false;
+          thread_unblock (drainer);
+        }
+    }
+  intr_set_level (old_level);
+
+  /* Not buffering: write straight to the devices. */
+  while (n-- > 0)
+    emit (*buffer++);
+}
+
+/* Sends C to the serial port and vga display. */
+static void
+emit (uint8_t c) 
+{
   serial_putc (c);
   vga_putc (c);
 }
+
+/* Console drain thread.  Sends buffered output to the devices
+   one byte at a time with interrupts on, so that it is the one
+   to sleep when the serial port's transmit queue is full. */
+static void
+drain (void *aux UNUSED) 
+{
+  intr_disable ();
+  drainer = thread_current ();
+  buffered = true;
+  for (;;) 
+    {
+      uint8_t c;
+
+      while (head == tail) 
+        {
+          if (flusher != NULL) 
+            {
+              thread_unblock (flusher);
+              flusher = NULL;
+            }
+          drainer_idle = true;
+          thread_block ();
+        }
+
+      c = buf[tail++ % BUF_SIZE];
+      if (writer != NULL && head - tail <= BUF_SIZE / 2) 
+        {
+          thread_unblock (writer);
+          writer = NULL;
+        }
+
+      intr_set_level (INTR_ON);
+      emit (c);
+      intr_disable ();
+    }
+}
@@ -2,7 +2,9 @@
 #define __LIB_KERNEL_CONSOLE_H
 
 void console_init (void);
+void console_init_queue (void);
 void console_panic (void);
+void console_flush (void);
 void console_print_stats (void);
 
 #endif /* lib/kernel/console.h */
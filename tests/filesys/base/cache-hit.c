@@ -0,0 +1,45 @@
+/* Writes a file small enough to fit in the buffer cache and
+   reads it back twice.  The first read also brings in the pages
+   of this program that reading uses; the second should find
+   nearly every sector it needs in the cache. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* 16 sectors, a quarter of the default cache. */
+#define FILE_SIZE (16 * 512)
+
+static char buf[FILE_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "cached";
+  struct cache_stats before, after;
+  unsigned long long hits, misses;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, sizeof buf) == sizeof buf,
+         "write \"%s\"", file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  check_file (file_name, buf, sizeof buf);
+
+  CHECK (cachestat (&before), "cachestat");
+  check_file (file_name, buf, sizeof buf);
+  CHECK (cachestat (&after), "cachestat");
+
+  hits = after.hits - before.hits;
+  misses = after.misses - before.misses;
+  if (hits < FILE_SIZE / 512 || misses * 10 > hits + misses)
+    fail ("re-read of \"%s\": %llu hits, %llu misses",
+          file_name, hits, misses);
+  msg ("re-read of \"%s\" hit the cache", file_name);
+}
@@ -0,0 +1,22 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-hit) begin
+(cache-hit) create "cached"
+(cache-hit) open "cached"
+(cache-hit) write "cached"
+(cache-hit) close "cached"
+(cache-hit) open "cached" for verification
+(cache-hit) verified contents of "cached"
+(cache-hit) close "cached"
+(cache-hit) cachestat
+(cache-hit) open "cached" for verification
+(cache-hit) verified contents of "cached"
+(cache-hit) close "cached"
+(cache-hit) cachestat
+(cache-hit) re-read of "cached" hit the cache
+(cache-hit) end
+EOF
+pass;
@@ -0,0 +1,159 @@
+/* Test and microbenchmark for lib/kernel/bitmap.c.
+
+   Checks bitmap_scan() and bitmap_count() against bit-by-bit
+   versions like the ones they replaced, then times both on a
+   mostly full bitmap of the size of a large free map.
+
+   This is not a test we will run on your submitted projects.
+   It is here for completeness.
+*/
+
+#undef NDEBUG
+#include <bitmap.h>
+#include <debug.h>
+#include <random.h>
+#include <stdio.h>
+#include "threads/test.h"
+#include "devices/timer.h"
+
+/* Number of bits in the bitmaps tested for correctness. */
+#define CHECK_BITS 200
+
+/* Number of bits in the benchmark bitmap: one per sector of an
+   8 MB disk. */
+#define BENCH_BITS 16384
+
+/* Number of scans or counts timed in each benchmark loop. */
+#define BENCH_ITERS 64
+
+/* Bit-by-bit bitmap_count(). */
+static size_t
+slow_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i, value_cnt = 0;
+
+  for (i = 0; i < cnt; i++)
+    if (bitmap_test (b, start + i) == value)
+      value_cnt++;
+  return value_cnt;
+}
+
+/* Bit-by-bit bitmap_scan(), rechecking every candidate run. */
+static size_t
+slow_scan (const struct bitmap *b, size_t start, size_t cnt, bool value)
+{
+  size_t i;
+
+  if (cnt > bitmap_size (b))
+    return BITMAP_ERROR;
+  for (i = start; i + cnt <= bitmap_size (b); i++)
+    if (slow_count (b, i, cnt, value) == cnt)
+      return i;
+  return BITMAP_ERROR;
+}
+
+/* Fills B at random, with about DENSITY bits in 8 set. */
+static void
+fill_random (struct bitmap *b, int density)
+{
+  size_t i;
+
+  for (i = 0; i < bitmap_size (b); i++)
+    bitmap_set (b, i, (int) (random_ulong () % 8) < density);
+}
+
+static void
+check (void)
+{
+  int round;
+
+  for (round = 0; round < 1000; round++)
+    {
+      size_t bit_cnt = random_ulong () % CHECK_BITS;
+      struct bitmap *b = bitmap_create (bit_cnt);
+      int i;
+
+      ASSERT (b != NULL);
+      fill_random (b, random_ulong () % 9);
+      for (i = 0; i < 8; i++)
+        {
+          size_t start = random_ulong () % (bit_cnt + 1);
+          size_t cnt = random_ulong () % (bit_cnt - start + 1);
+          size_t run = random_ulong () % 12;
+          bool value = random_ulong () % 2;
+
+          ASSERT (bitmap_count (b, start, cnt, value)
+                  == slow_count (b, start, cnt, value));
+          ASSERT (bitmap_contains (b, start, cnt, value)
+                  == (slow_count (b, start, cnt, value) > 0));
+          ASSERT (bitmap_scan (b, start, run, value)
+                  == slow_scan (b, start, run, value));
+        }
+      bitmap_destroy (b);
+    }
+}
+
+/* Times BENCH_ITERS scans for a run of CNT free bits in B, first
+   bit by bit and then with bitmap_scan(). */
+static void
+bench_scan (const struct bitmap *b, size_t cnt)
+{
+  int64_t start;
+  size_t slow = 0, fast = 0;
+  int i;
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_ITERS; i++)
+    slow = slow_scan (b, 0, cnt, false);
+  printf ("scan for %zu: %lld ticks bit by bit\n",
+          cnt, timer_elapsed (start));
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_ITERS; i++)
+    fast = bitmap_scan (b, 0, cnt, false);
+  printf ("scan for %zu: %lld ticks a word at a time\n",
+          cnt, timer_elapsed (start));
+
+  ASSERT (slow == fast);
+}
+
+static void
+bench (void)
+{
+  struct bitmap *b = bitmap_create (BENCH_BITS);
+  int64_t start;
+  int i;
+
+  ASSERT (b != NULL);
+
+  /* A nearly full disk: everything in use except scattered
+     sectors and one run of 64 near the end. */
+  fill_random (b, 7);
+  bitmap_set_multiple (b, 0, BENCH_BITS / 2, true);
+  bitmap_set_multiple (b, BENCH_BITS - 100, 64, false);
+
+  bench_scan (b, 1);
+  bench_scan (b, 8);
+  bench_scan (b, 64);
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_ITERS; i++)
+    slow_count (b, 0, BENCH_BITS, true);
+  printf ("count: %lld ticks bit by bit\n", timer_elapsed (start));
+
+  start = timer_ticks ();
+  for (i = 0; i < BENCH_ITERS; i++)
+    bitmap_count (b, 0, BENCH_BITS, true);
+  printf ("count: %lld ticks a word at a time\n", timer_elapsed (start));
+
+  bitmap_destroy (b);
+}
+
+/* Test the bitmap implementation. */
+void
+test (void)
+{
+  check ();
+  bench ();
+  printf (" done\n");
+}
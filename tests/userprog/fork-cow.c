@@ -0,0 +1,33 @@
+/* Forks a child that overwrites a buffer it shares copy-on-write
+   with its parent, and checks that the parent's copy of the
+   buffer did not change. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static char buf[8192];
+
+void
+test_main (void) 
+{
+  pid_t pid;
+  size_t i;
+
+  memset (buf, 'a', sizeof buf);
+  msg ("fork");
+  pid = fork ();
+  if (pid == 0)
+    {
+      memset (buf, 'b', sizeof buf);
+      exit (81);
+    }
+  if (pid < 0)
+    fail ("fork() returned %d", pid);
+  CHECK (wait (pid) == 81, "wait for child");
+  for (i = 0; i < sizeof buf; i++)
+    if (buf[i] != 'a')
+      fail ("byte %zu changed to '%c'", i, buf[i]);
+  msg ("parent's buffer unchanged");
+}
@@ -0,0 +1,26 @@
+/* Reads "sample.txt" in two pieces with pread, out of order,
+   and checks that the file position did not move. */
+
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[sizeof sample];
+  size_t half = (sizeof sample - 1) / 2;
+  int handle;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  if (pread (handle, buf + half, sizeof sample - 1 - half, half)
+      != (int) (sizeof sample - 1 - half))
+    fail ("pread() of second half failed");
+  if (pread (handle, buf, half, 0) != (int) half)
+    fail ("pread() of first half failed");
+  compare_bytes (buf, sample, sizeof sample - 1, 0, "sample.txt");
+  if (tell (handle) != 0)
+    fail ("file position moved to %u", tell (handle));
+  msg ("pread \"sample.txt\"");
+}
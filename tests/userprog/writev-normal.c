@@ -0,0 +1,36 @@
+/* Writes "sample.txt" into a new file from three buffers with
+   writev, then reads it back into three differently split
+   buffers with readv. */
+
+#include <iovec.h>
+#include <syscall.h>
+#include "tests/userprog/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  char buf[sizeof sample];
+  size_t size = sizeof sample - 1;
+  struct iovec out[3] = {
+    { sample, 10 },
+    { sample + 10, 0 },
+    { sample + 10, size - 10 },
+  };
+  struct iovec in[3] = {
+    { buf, size - 20 },
+    { buf + size - 20, 19 },
+    { buf + size - 1, 1 },
+  };
+  int handle;
+
+  CHECK (create ("test.txt", 0), "create \"test.txt\"");
+  CHECK ((handle = open ("test.txt")) > 1, "open \"test.txt\"");
+  CHECK (writev (handle, out, 3) == (int) size, "writev \"test.txt\"");
+  seek (handle, 0);
+  CHECK (readv (handle, in, 3) == (int) size, "readv \"test.txt\"");
+  compare_bytes (buf, sample, size, 0, "test.txt");
+  msg ("close \"test.txt\"");
+  close (handle);
+}
@@ -0,0 +1,25 @@
+/* Writes one line to the console from three buffers with
+   writev. */
+
+#include <iovec.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  static char prefix[] = "(writev-stdout) ";
+  static char hello[] = "hello, ";
+  static char world[] = "world\n";
+  struct iovec iov[3] = {
+    { prefix, sizeof prefix - 1 },
+    { hello, sizeof hello - 1 },
+    { world, sizeof world - 1 },
+  };
+  int size = strlen (prefix) + strlen (hello) + strlen (world);
+
+  CHECK (writev (STDOUT_FILENO, iov, 3) == size, "writev to stdout");
+}
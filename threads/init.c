@@ -35,6 +35,7 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -63,6 +64,9 @@ static void paging_init (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
+#ifdef FILESYS
+static int parse_percent (const char *name, const char *value);
+#endif
 static void run_actions (char **argv);
 static void usage (void);
 
@@ -119,6 +123,11 @@ main (void)
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
   serial_init_queue ();
+#ifdef USERPROG
+  /* Not for the threads tests, whose load averages would count
+     the console thread. */
+  console_init_queue ();
+#endif
   timer_calibrate ();
 
 #ifdef FILESYS
@@ -253,6 +262,27 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (value != NULL && !strcmp (value, "clock"))
+            cache_policy = CACHE_POLICY_CLOCK;
+          else if (value != NULL && !strcmp (value, "aging"))
+            cache_policy = CACHE_POLICY_AGING;
+          else
+            PANIC ("unknown cache policy `%s' (use clock or aging)",
+                   value != NULL ? value : "");
+        }
+      else if (!strcmp (name, "-cache-size"))
+        {
+          int size = value != NULL ? atoi (value) : 0;
+          if (size <= 0)
+            PANIC ("invalid cache size `%s'", value != NULL ? value : "");
+          cache_size = size;
+        }
+      else if (!strcmp (name, "-cache-dirty-high"))
+        cache_dirty_high = parse_percent (name, value);
+      else if (!strcmp (name, "-cache-dirty-low"))
+        cache_dirty_low = parse_percent (name, value);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -270,6 +300,12 @@ parse_options (char **argv)
         PANIC ("unknown option `%s' (use -h for help)", name);
     }
 
+#ifdef FILESYS
+  if (cache_dirty_low > cache_dirty_high)
+    PANIC ("-cache-dirty-low (%d) is above -cache-dirty-high (%d)",
+           cache_dirty_low, cache_dirty_high);
+#endif
+
   /* Initialize the random number generator based on the system
      time.  This has no effect if an "-rs" option was specified.
 
@@ -283,6 +319,25 @@ parse_options (char **argv)
   return argv;
 }
 
+#ifdef FILESYS
+/* Returns VALUE, the argument to option NAME, as a percentage.
+   Panics unless VALUE is a number from 0 to 100. */
+static int
+parse_percent (const char *name, const char *value)
+{
+  const char *p;
+
+  if (value == NULL || *value == '\0' || strlen (value) > 3)
+    PANIC ("%s needs a percentage from 0 to 100", name);
+  for (p = value; *p != '\0'; p++)
+    if (*p < '0' || *p > '9')
+      PANIC ("invalid percentage `%s' for %s", value, name);
+  if (atoi (value) > 100)
+    PANIC ("percentage `%s' for %s is above 100", value, name);
+  return atoi (value);
+}
+#endif
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv)
@@ -381,6 +436,10 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -cache-policy=POL  Evict buffer cache blocks by POL (clock, aging).\n"
+          "  -cache-size=N      Cache N sectors of the file system in memory.\n"
+          "  -cache-dirty-high=PCT  Start write-behind above PCT%% dirty.\n"
+          "  -cache-dirty-low=PCT   Stop write-behind at PCT%% dirty.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -75,10 +75,10 @@ typedef int tid_t;
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
+/* An open file descriptor, in thread->fds. */
 struct file_desc {
-        int id;
-        struct list_elem elem;
-        struct file* file;
+        struct file* file;      /* Null if the slot is free. */
+        struct dir* dir;        /* Non-null if FILE is a directory. */
 };
 
 struct child_thread {
@@ -126,18 +126,28 @@ struct thread
     /* Owned by userprog/process.c. */
     uint32_t *pagedir;                  /* Page directory. */
     struct hash sup_pagedir;              /* Supplimental page directory*/
+    struct intr_frame *user_frame;      /* User registers on entry to
+                                           the current system call. */
 
 
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
 
-    struct list file_descrips;
+    struct file_desc *fds;              /* Open files, indexed by fd
+                                           minus FD_MIN. */
+    int fd_cnt;                         /* Number of slots in FDS. */
+    int fd_free;                        /* No free slot below this. */
     struct list child_threads;
 
     struct child_process* cp;
 
     struct file* file;    
 
+#ifdef FILESYS
+    /* Owned by filesys/filesys.c. */
+    struct dir *cwd;                    /* Working directory, or null
+                                           for the root. */
+#endif
   };
 
 /*Data structure for holding information about a waiting thread*/
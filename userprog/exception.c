@@ -1,7 +1,9 @@
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/exception.h"
+#include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
@@ -122,9 +124,115 @@ kill (struct intr_frame *f)
     }
 }
 
-/* Page fault handler.  This is a skeleton that must be filled in
-   to implement virtual memory.  Some solutions to project 2 may
-   also require modifying this code.
+/* Brings in the page containing FAULT_ADDR, a user address that
+   is not present, for the current process, whose user stack
+   pointer is ESP.  Returns true if the page is now mapped, false
+   if FAULT_ADDR is not part of the process's address space or
+   the page could not be brought in. */
+static bool
+page_in (void *fault_addr_original, void *esp)
+{
+  void* fault_addr;
+  void* kpage;
+  struct thread* t;
+  struct sup_pte* spte;
+
+  // Get the address of the actual page
+  fault_addr = pg_round_down(fault_addr_original); //page aligning the fault_addr
+  t = thread_current();
+
+  // Obtain the page table entry for the requested page
+  spte = get_pte(fault_addr);
+  if(spte == NULL) {
+    // Handle stack growth: check if the memory access is within
+    // a page of the stack pointer
+    int difference = (int) (((uint32_t) esp) - ((uint32_t)fault_addr_original));
+
+    if(difference < PGSIZE && difference > -(20 * PGSIZE)) {
+      kpage = frame_allocate(PAL_USER | PAL_ZERO, esp);
+      if(kpage == NULL) {
+        printf("Stack page allocation failed\n");
+        return false;
+      }
+      zero_sup_pte(esp, true);
+      if(!pagedir_set_page(t->pagedir, fault_addr, kpage, true)) {
+        printf("Stack page allocation mapping failed\n");
+        return false;
+      }
+      return true;
+    }
+
+    // Invalid memory access
+    return false;
+  }
+
+  // Read-only pages of an executable are shared with every other
+  // process running it
+  if(spte->type == SPTE_FS && !spte->writable) {
+    return load_page_shared(spte);
+  }
+
+  // Allocate the frame for  the requested virtual address
+  kpage = frame_allocate(PAL_USER, fault_addr);
+  if(kpage == NULL) {
+    printf("Frame allocation failed.\n");
+    return false;
+  }
+
+  // Set the virtual page mapping to the new physical frame
+  if(!pagedir_set_page(t->pagedir, fault_addr, kpage, spte->writable)) {
+    printf("Page mapping failed");
+    return false;
+  }
+
+  switch(spte->type) {
+    case SPTE_FS:
+      if (spte->read_bytes > 0){
+        if (file_read_at(spte->file, kpage, spte->read_bytes, spte->offset) != (int) spte->read_bytes){
+          printf("Error loading file into memory");
+          return false;
+        }
+      }
+
+      // Zero pad the rest of the page
+      memset(kpage + spte->read_bytes, 0, spte->zero_bytes);
+      break;
+    case SPTE_MMAP: break;
+    case SPTE_SWAP:
+      swap_read(spte->swap, kpage);
+      break;
+    case SPTE_ZERO: break;
+  }
+
+  frame_set_done(kpage, true);
+  pagedir_set_dirty(t->pagedir, fault_addr, false);
+  return true;
+}
+
+/* Gives the current process its own writable copy of the
+   copy-on-write page containing FAULT_ADDR, see pagedir_share().
+   Returns false if the page is not copy-on-write or no frame is
+   available. */
+static bool
+copy_on_write (void *fault_addr)
+{
+  void* upage = pg_round_down(fault_addr);
+  uint32_t* pd = thread_current()->pagedir;
+  void* kpage;
+
+  if(!pagedir_is_cow(pd, upage)) {
+    return false;
+  }
+
+  kpage = frame_unshare(pagedir_get_page(pd, upage), upage);
+  if(kpage == NULL) {
+    return false;
+  }
+  pagedir_clear_page(pd, upage);
+  return pagedir_set_page(pd, upage, kpage, true);
+}
+
+/* Page fault handler.
 
    At entry, the address that faulted is in CR2 (Control Register
    2) and information about the fault, formatted as described in
@@ -132,15 +240,23 @@ kill (struct intr_frame *f)
    example code here shows how to parse that information.  You
    can find more information about both of these in the
    description of "Interrupt 14--Page Fault Exception (#PF)" in
-   [IA32-v3a] section 5.15 "Exception and Interrupt Reference". */
+   [IA32-v3a] section 5.15 "Exception and Interrupt Reference".
+
+   A not-present page at a user address is brought in, and a
+   write to a copy-on-write page is given its own copy, whether
+   the user process or the kernel touched it.  The kernel touches
+   user memory only through get_user(), put_user() and the copy
+   routines in userprog/syscall.c, so a kernel fault on a user
+   address that can't be brought in is one of theirs: it sets EIP
+   to the recovery address they left in EAX and makes them return
+   -1 there, instead of killing the thread. */
 static void
 page_fault (struct intr_frame *f) 
 {
   bool not_present;  /* True: not-present page, false: writing r/o page. */
   bool write;        /* True: access was write, false: access was read. */
   bool user;         /* True: access by user, false: access by kernel. */
-  void *fault_addr;  /* Fault address. */
-  void* fault_addr_original;
+  void* fault_addr;  /* Fault address. */
 
   /* Obtain faulting address, the virtual address that was
      accessed to cause the fault.  It may point to code or to
@@ -149,7 +265,7 @@ page_fault (struct intr_frame *f)
      See [IA32-v2a] "MOV--Move to/from Control Registers" and
      [IA32-v3a] 5.15 "Interrupt 14--Page Fault Exception
      (#PF)". */
-  asm ("movl %%cr2, %0" : "=r" (fault_addr_original));
+  asm ("movl %%cr2, %0" : "=r" (fault_addr));
 
   /* Turn interrupts back on (they were only off so that we could
      be assured of reading CR2 before it changed). */
@@ -163,195 +279,36 @@ page_fault (struct intr_frame *f)
   write = (f->error_code & PF_W) != 0;
   user = (f->error_code & PF_U) != 0;
 
-  /* To implement virtual memory, delete the rest of the function
-     body, and replace it with code that brings in the page to
-     which fault_addr refers. */
-  
-  //printf("I demand a page \n");
-  //printf ("Page fault at %p: %s error %s page in %s context.\n",fault_addr_original,not_present ? "not present" : "rights violation",write ? "writing" : "reading",user ? "user" : "kernel");
-
-  // If the memory access was not in userspace
-  if(!user) {
-    //printf("Not in user space!\n");
+  // A kernel access outside user memory is a kernel bug.
+  if(!user && !is_user_vaddr(fault_addr)) {
     kill(f);
-    //thread_exit();
-  } 
+  }
 
-   if(fault_addr_original == 0) {
-    //printf("Fault address is zero\n");
-    kill(f);
+  // The kernel has no user stack pointer in F, so use the one
+  // saved on entry to the system call.
+  if(fault_addr != NULL && is_user_vaddr(fault_addr) && not_present
+     && page_in(fault_addr,
+                user ? f->esp : thread_current()->user_frame->esp)) {
     return;
-   }
-
-   /*printf("Page directory: %p\n", thread_current()->pagedir);
-   if(pagedir_is_dirty(thread_current()->pagedir, fault_addr)) {
-     printf("Page is dirty\n");
-   }
-   else {
-     printf("Page is clean\n");
-   }*/
-
-  // If the page is not present in physical memory
-  if(not_present){
-    void* esp;
-    void* upage;
-    void* kpage;
-    bool success;
-    struct thread* t;
-    struct sup_pte* spte;
-
-    esp = f->esp;
-
-    //printf("esp + 4 bytes: %p\n", esp + 1);
-    //printf("esp + 32 bytes: %p\n", esp + 8);
-
-    // Get the address of the actual page
-    fault_addr = pg_round_down(fault_addr_original); //page aligning the fault_addr
-    //printf("esp: %p fault_addr: %p\n", esp, fault_addr);
-    t = thread_current();
-
-    // Obtain the page table entry for the requested page
-    spte = get_pte(fault_addr);
-    //printf("page fault address %p \n", spte->uaddr);
-    if(spte == NULL) {
-      //printf("Obtaining supplemental page table entry failed.\n");
-      //printf("Fault address: %p\n", fault_addr);
-
-      // Handle stack growth
-      // Get stack pointer for user/kernel context
-      if(user) {
-        esp = f->esp;
-      }
-      else {
-        esp = thread_current()->stack;
-      }
-      //printf("Difference in fault addr and stack: %d", ((uint32_t*) PHYS_BASE) - ((uint32_t*) fault_addr));
-      // Check if the stack is too big 
-      /*if(((uint32_t*) PHYS_BASE) - ((uint32_t*) fault_addr) >= MAX_STACK_SIZE) {
-        //printf("Stack is too big\n");
-        thread_exit();
-      }*/
-
-      // Check if the memory access is within a page of the stack pointer
-      int difference = (int) (((uint32_t) esp) - ((uint32_t)fault_addr_original));
-      //printf("Fault addr - esp: %d\n", difference);
-
-      if(difference < PGSIZE && difference > -(20 * PGSIZE)) {
-        //printf("Allocating stack memory\n");
-        upage = esp;
-        kpage = frame_allocate(PAL_USER | PAL_ZERO, upage);
-        if(kpage == NULL) {
-          printf("Stack page allocation failed\n");
-          kill(f);
-        }
-        zero_sup_pte(upage, true);
-        if(!pagedir_set_page(thread_current()->pagedir, fault_addr, kpage, true)) {
-          printf("Stack page allocation mapping failed\n");
-          kill(f);
-        }
-        return;
-      }
-
-      // Invalid memory access
-      else {
-        //printf("Invalid memory access\n");
-        thread_exit();
-      }
-    }
-
-    // Allocate the frame for  the requested virtual address
-    kpage = frame_allocate(PAL_USER, fault_addr);
-    if(kpage == NULL) {
-      printf("Frame allocation failed.\n");
-      kill(f);
-      return;
-    }
-
-    // Set the virtual page mapping to the new physical frame
-    if(!pagedir_set_page(t->pagedir, fault_addr, kpage, spte->writable)) {
-      printf("Page mapping failed");
-      return;
-    }
-
-   // pagedir_clear_page (t->pagedir, spte->uaddr);
-
-    switch(spte->type) {
-      case SPTE_FS: //load_page_file(spte); break;
-        if (spte->read_bytes > 0){
-          if (file_read_at(spte->file, kpage, spte->read_bytes, spte->offset) != (int) spte->read_bytes){
-            printf("Error loading file into memory");
-            return;
-          }
-        }
-
-        // Zero pad the rest of the page
-        memset(kpage + spte->read_bytes, 0, spte->zero_bytes);
-        break;
-      case SPTE_MMAP: break;
-      case SPTE_SWAP: 
-	      swap_read(spte->swap, kpage);
-	      break;
-      case SPTE_ZERO: break;
-        memset(kpage, 0, PGSIZE);
-        break;
-    }
-
-    frame_set_done(kpage, true);
-    pagedir_set_dirty(t->pagedir, fault_addr, false);
-   // pagedir_set_page(thread_current()->pagedir, upage, kpage, true);
   }
 
-  // Handle rights violations
-  else /*if (stack_heuristic(f, fault_addr)) */{
-
-    //printf("Hits else statement\n");
-    /*void* esp;
-    void* upage;
-    void* kpage;
-
-    // Get the user program's stack pointer
-    if(user) {
-      esp = f->esp;
-    }
-    else {
-      esp = thread_current()->stack;
-    }
-
-    // If the stack pointer is 4 or 32 bytes below esp, we need to allocate a new page
-    if(esp - 4 == fault_addr || esp - 32 == fault_addr || !user) {
-      //printf("Stack is below esp, need to allocate a new page\n");
-      // Check to make sure the memory a
-      /*if(((uint32_t*) PHYS_BASE) - ((uint32_t*) fault_addr) > MAX_STACK_SIZE) {
-        printf("Stack is too big\n");
-        kill(f);
-      }*/
-
-      /*upage = esp;
-      kpage = frame_allocate(PAL_USER | PAL_ZERO, upage);
-      if(kpage == NULL) {
-        printf("Frame allocation has failed\n");
-        return;
-      }
-      zero_sup_pte(upage, true);
-      pagedir_set_page(thread_current()->pagedir, upage, kpage, true);
-      frame_set_done(kpage, true);
-      return;
-    }*/
-    thread_exit();
+  // A write to a page shared with a forked process.
+  if(fault_addr != NULL && is_user_vaddr(fault_addr) && !not_present
+     && write && copy_on_write(fault_addr)) {
+    return;
   }
-  
-  // Not stack growth, it is present, it is user.
-
-		// stack growth
-    //kpage = palloc_get_page(PAL_USER | PAL_ZERO);
-    //upage = esp;
-    //kpage = frame_allocate(PAL_USER, fault_addr);
-   // success = install_page(fault_addr, kpage, 1); //grow stack by 1 page
 
+  // A bad user address passed to get_user(), put_user() or a
+  // copy routine.
+  if(!user) {
+    f->eip = (void (*) (void)) f->eax;
+    f->eax = 0xffffffff;
+    return;
+  }
 
-  /*
-  Page fault in the kernel context.
-  */
- 
-  //kill (f)
+  // Invalid access or rights violation by the process.
+  if(fault_addr == NULL) {
+    kill(f);
+  }
+  thread_exit();
 }
@@ -8,6 +8,7 @@
 #include "threads/vaddr.h"
 
 static uint32_t *active_pd (void);
+static uint32_t *lookup_page (uint32_t *pd, const void *vaddr, bool create);
 static void invalidate_pagedir (uint32_t *);
 
 /* Creates a new page directory that has mappings for kernel
@@ -48,6 +49,77 @@ pagedir_destroy (uint32_t *pd)
   palloc_free_page (pd);
 }
 
+/* Maps every user page present in SRC at the same virtual
+   address in DST, for copy-on-write: writable pages become
+   read-only and PTE_COW in both page directories, so that the
+   first write to one faults and can be given its own copy.
+   Calls SHARE with the kernel address of each page mapped.
+   Returns true if successful, false if memory allocation for
+   DST's page tables failed, in which case DST maps only some of
+   the pages. */
+bool
+pagedir_share (uint32_t *dst, uint32_t *src, void (*share) (void *kpage))
+{
+  uint32_t *pde;
+
+  ASSERT (dst != init_page_dir && src != init_page_dir);
+
+  for (pde = src; pde < src + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P) 
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *pte;
+
+        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+          if (*pte & PTE_P) 
+            {
+              void *upage = (void *) (((uintptr_t) (pde - src) << PDSHIFT)
+                                      | ((uintptr_t) (pte - pt) << PTSHIFT));
+              uint32_t *dst_pte = lookup_page (dst, upage, true);
+
+              if (dst_pte == NULL)
+                {
+                  invalidate_pagedir (src);
+                  return false;
+                }
+              if (*pte & PTE_W)
+                *pte = (*pte & ~(uint32_t) PTE_W) | PTE_COW;
+              ASSERT ((*dst_pte & PTE_P) == 0);
+              *dst_pte = *pte;
+              share (pte_get_page (*pte));
+            }
+      }
+  invalidate_pagedir (src);
+  return true;
+}
+
+/* Marks every user page in PD "not present" and calls RELEASE
+   with its kernel address, handing the page over to RELEASE
+   instead of leaving it for pagedir_destroy() to free.  Used
+   when pages may be mapped by more than one page directory. */
+void
+pagedir_release (uint32_t *pd, void (*release) (void *kpage))
+{
+  uint32_t *pde;
+
+  for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
+    if (*pde & PTE_P) 
+      {
+        uint32_t *pt = pde_get_pt (*pde);
+        uint32_t *pte;
+
+        for (pte = pt; pte < pt + PGSIZE / sizeof *pte; pte++)
+          if (*pte & PTE_P) 
+            {
+              void *kpage = pte_get_page (*pte);
+
+              *pte &= ~(uint32_t) PTE_P;
+              release (kpage);
+            }
+      }
+  invalidate_pagedir (pd);
+}
+
 /* Returns the address of the page table entry for virtual
    address VADDR in page directory PD.
    If PD does not have a page table for VADDR, behavior depends
@@ -157,6 +229,15 @@ pagedir_clear_page (uint32_t *pd, void *upage)
     }
 }
 
+/* Returns true if user virtual page UPAGE is mapped in PD
+   read-only for copy-on-write, see pagedir_share(). */
+bool
+pagedir_is_cow (uint32_t *pd, const void *upage) 
+{
+  uint32_t *pte = lookup_page (pd, upage, false);
+  return pte != NULL && (*pte & (PTE_P | PTE_COW)) == (PTE_P | PTE_COW);
+}
+
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
    installed.
@@ -24,6 +24,7 @@
 #include "vm/swap.h"
 
 static thread_func start_process NO_RETURN;
+static thread_func fork_process NO_RETURN;
 static bool load (const char *cmdline, void (**eip) (void), void **esp);
 
 static struct semaphore sem_load;
@@ -146,6 +147,93 @@ start_process (void *file_name_)
   NOT_REACHED ();
 }
 
+/* What process_fork() hands to the child's fork_process(). */
+struct fork_args
+  {
+    struct intr_frame if_;              /* Parent's user registers. */
+    struct thread *parent;              /* Process being forked. */
+    struct child_process *cp;           /* Child's record in PARENT. */
+    struct semaphore done;              /* Upped once the child is set up. */
+    bool success;                       /* Did the child set up? */
+  };
+
+/* Starts a new process that is a copy of the current one, which
+   entered the kernel with user registers IF_.  The child starts
+   out sharing every page of the parent copy-on-write, so forking
+   costs a copy of the page tables rather than of the memory.  It
+   returns to user mode at the same place as the parent, with 0
+   in EAX.  Returns the child's thread id, or TID_ERROR if the
+   child could not be created. */
+tid_t
+process_fork (const struct intr_frame *if_)
+{
+  struct fork_args args;
+  tid_t tid;
+
+  args.if_ = *if_;
+  args.parent = thread_current ();
+  sema_init (&args.done, 0);
+  args.success = false;
+  args.cp = add_child_process (TID_ERROR);
+  if (args.cp == NULL)
+    return TID_ERROR;
+
+  tid = thread_create (args.parent->name, PRI_DEFAULT, fork_process, &args);
+  if (tid == TID_ERROR)
+    {
+      remove_child_process (args.cp);
+      return TID_ERROR;
+    }
+  args.cp->pid = tid;
+  sema_down (&args.done);
+
+  /* A child that failed to set up exits at once; reap it. */
+  if (!args.success)
+    {
+      process_wait (tid);
+      return TID_ERROR;
+    }
+  return tid;
+}
+
+/* A thread function that copies the process that called
+   process_fork() and starts the copy running. */
+static void
+fork_process (void *args_)
+{
+  struct fork_args *args = args_;
+  struct thread *parent = args->parent;
+  struct thread *t = thread_current ();
+  struct intr_frame if_ = args->if_;
+
+  t->cp = args->cp;
+  t->parent_tid = parent->tid;
+  t->pagedir = pagedir_create ();
+  hash_init (&(t->sup_pagedir), page_hash, page_less, NULL);
+  if (t->pagedir != NULL)
+    {
+      process_activate ();
+      t->file = file_reopen (parent->file);
+      args->success = (t->file != NULL
+                       && copy_sup_pt (parent, t->file)
+                       && pagedir_share (t->pagedir, parent->pagedir,
+                                         frame_ref)
+                       && process_copy_files (parent));
+    }
+  if (!args->success)
+    {
+      sema_up (&args->done);
+      thread_exit ();
+    }
+  file_deny_write (t->file);
+  sema_up (&args->done);
+
+  /* The child's fork() returns 0. */
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -218,7 +306,8 @@ process_exit (void)
   }
 
   printf("%s: exit(%d)\n", cur->name, cur->cp->status);
-  file_allow_write(cur->file);
+  if (cur->file != NULL)
+    file_allow_write(cur->file);
   file_close (cur->file);
   sema_up(&(cur->cp->sem_read));
 
@@ -251,6 +340,7 @@ process_exit (void)
          directory before destroying the process's page
          directory, or our active page directory will be one
          that's been freed (and cleared). */
+      pagedir_release (pd, frame_release);
       cur->pagedir = NULL;
       pagedir_activate (NULL);
       pagedir_destroy (pd);
@@ -480,8 +570,14 @@ load (const char *file_name, void (**eip) (void), void **esp)
   //printf("Stack setup successful\n");
 
   done:
-    /* We arrive here whether the load is successful or not. */
-    file_close(file);
+    /* We arrive here whether the load is successful or not.  On
+       success the file stays open as t->file, for loading pages
+       on demand, and process_exit() closes it. */
+    if (!success)
+      {
+        file_close(file);
+        t->file = NULL;
+      }
     return success;
 }
 
@@ -3,6 +3,9 @@
 #include <stdio.h>
 #include <syscall-nr.h>
 #include <stdlib.h>
+#include <string.h>
+#include <iovec.h>
+#include <round.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/synch.h"
@@ -11,20 +14,27 @@
 #include "devices/input.h"
 #include "devices/shutdown.h"
 #include "filesys/file.h"
+#include "filesys/cache.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "vm/page.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
 #include <debug.h>
 
-#define ARGS_MAX 3
+#define ARGS_MAX 4
+
+/* Most pages of kernel buffer one file read or write goes
+   through at a time.  Larger requests are split into pieces of
+   this size, each one a single inode operation. */
+#define IO_BOUNCE_PAGES 8
 #define USER_VADDR_BOTTOM ((void*) 0x08048000)
 
 static void syscall_handler (struct intr_frame *);
 
 struct lock file_sys_lock;
 
-void check_valid_pointer(void* addr);
 void halt(void);
 void exit(int status);
 pid_t exec(const char* cmd_line);
@@ -38,10 +48,23 @@ int write(int fd, const void* buffer, unsigned size);
 void seek(int fd, unsigned position);
 unsigned tell(int fd);
 void close(int fd);
+bool chdir(const char* dir);
+bool mkdir(const char* dir);
+bool readdir(int fd, char* name);
+bool isdir(int fd);
+int inumber(int fd);
+bool cachestat(struct cache_stats* stats);
+int pread(int fd, void* buffer, unsigned size, unsigned offset);
+int pwrite(int fd, const void* buffer, unsigned size, unsigned offset);
+int readv(int fd, const struct iovec* iov, int iov_cnt);
+int writev(int fd, const struct iovec* iov, int iov_cnt);
+pid_t fork(void);
 struct file_desc* get_fd(int fd);
-int get_user(const uint8_t* uaddr);
-int user_to_kernel_ptr(void* vaddr);
-void get_args(struct intr_frame* f, int* arg, int n); 
+static struct file_desc* get_slot(int fd);
+static int alloc_fd(void);
+static void free_fd(int fd);
+static bool is_user_range(const void* uaddr, size_t size);
+static char* copy_in_string(const char* ustr);
 
 void
 syscall_init (void) 
@@ -51,86 +74,189 @@ syscall_init (void)
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
+/* Each system call's handler, which takes the call's argument
+   words and returns the value for EAX. */
+typedef uint32_t syscall_func (const uint32_t* args);
+
+static syscall_func sys_halt, sys_exit, sys_exec, sys_wait, sys_create,
+	sys_remove, sys_open, sys_filesize, sys_read, sys_write, sys_seek,
+	sys_tell, sys_close, sys_chdir, sys_mkdir, sys_readdir, sys_isdir,
+	sys_inumber, sys_cachestat, sys_pread, sys_pwrite, sys_readv,
+	sys_writev, sys_fork;
+
+/* A system call. */
+struct syscall {
+	int arity;                  /* Number of argument words. */
+	unsigned str_args;          /* Bit I set: argument I is a user
+	                               string, passed to FUNC as a copy
+	                               in kernel memory. */
+	syscall_func* func;         /* Handler. */
+};
+
+/* System calls by number.  A null FUNC means not implemented. */
+static const struct syscall syscalls[] = {
+	[SYS_HALT]      = {0, 0x0, sys_halt},
+	[SYS_EXIT]      = {1, 0x0, sys_exit},
+	[SYS_EXEC]      = {1, 0x1, sys_exec},
+	[SYS_WAIT]      = {1, 0x0, sys_wait},
+	[SYS_CREATE]    = {2, 0x1, sys_create},
+	[SYS_REMOVE]    = {1, 0x1, sys_remove},
+	[SYS_OPEN]      = {1, 0x1, sys_open},
+	[SYS_FILESIZE]  = {1, 0x0, sys_filesize},
+	[SYS_READ]      = {3, 0x0, sys_read},
+	[SYS_WRITE]     = {3, 0x0, sys_write},
+	[SYS_SEEK]      = {2, 0x0, sys_seek},
+	[SYS_TELL]      = {1, 0x0, sys_tell},
+	[SYS_CLOSE]     = {1, 0x0, sys_close},
+	[SYS_CHDIR]     = {1, 0x1, sys_chdir},
+	[SYS_MKDIR]     = {1, 0x1, sys_mkdir},
+	[SYS_READDIR]   = {2, 0x0, sys_readdir},
+	[SYS_ISDIR]     = {1, 0x0, sys_isdir},
+	[SYS_INUMBER]   = {1, 0x0, sys_inumber},
+	[SYS_CACHESTAT] = {1, 0x0, sys_cachestat},
+	[SYS_PREAD]     = {4, 0x0, sys_pread},
+	[SYS_PWRITE]    = {4, 0x0, sys_pwrite},
+	[SYS_READV]     = {3, 0x0, sys_readv},
+	[SYS_WRITEV]    = {3, 0x0, sys_writev},
+	[SYS_FORK]      = {0, 0x0, sys_fork},
+};
+
+#define SYSCALL_CNT (sizeof syscalls / sizeof *syscalls)
+
 static void
-syscall_handler (struct intr_frame *f UNUSED) 
+syscall_handler (struct intr_frame *f) 
 {	
-	int args[ARGS_MAX];
-	check_valid_pointer(f->esp);
-	switch(*(int*) f->esp) {
-	case SYS_HALT:
-	//printf("SYS_HALT\n");
-		halt();
-		break;
-	case SYS_EXIT:
-	//printf("SYS_EXIT\n");
-		get_args(f, &args[0], 1);
-		exit(args[0]);
-		break;
-	case SYS_EXEC:
-	//printf("SYS_EXEC\n");
-		get_args(f, &args[0], 1);
-		user_to_kernel_ptr((void*) args[0]);
-		f->eax = exec((const char*)args[0]);
-		break;
-	case SYS_WAIT:
-	//printf("SYS_WAIT\n");
-		get_args(f, &args[0], 1);
-		f->eax = wait(args[0]);
-		break;
-	case SYS_CREATE:
-	//printf("SYS_CREATE\n");
-		get_args(f, &args[0], 2);
-		user_to_kernel_ptr((void*) args[0]);
-		f->eax = create((const char*) args[0], (unsigned) args[1]);
-		break;
-	case SYS_REMOVE:
-	//printf("SYS_REMOVE\n");
-		get_args(f, &args[0], 1);
-		user_to_kernel_ptr((void*) args[0]);
-		f->eax = remove((const char*) args[0]);
-		break;
-	case SYS_OPEN:
-	//printf("SYS_OPEN\n");
-		get_args(f, &args[0], 1);
-		user_to_kernel_ptr((void*) args[0]);
-		f->eax = open((const char*)args[0]);
-		break;
-	case SYS_FILESIZE:
-//	printf("SYS_FILESIZE\n");
-		get_args(f, &args[0], 1);
-		f->eax = filesize(args[0]);
-		break;
-	case SYS_READ:
-//	printf("SYS_READ\n");
-		get_args(f, &args[0], 3);
-		f->eax = read(args[0], (void*) args[1], (unsigned) args[2]);
-		break;
-	case SYS_WRITE:
-//	printf("SYS_WRITE\n");
-		get_args(f, &args[0], 3);
-		user_to_kernel_ptr((void*) args[1]);
-		//f->eax = read(args[0], (void*) args[1], (unsigned) args[2]);
-		f->eax = write(args[0], (void*) args[1], (unsigned) args[2]);
-		break;
-	case SYS_SEEK:
-//	printf("SYS_SEEK\n");
-		get_args(f, &args[0], 2);
-		seek(args[0], (unsigned) args[1]);
-		break;
-	case SYS_TELL:
-//	printf("SYS_TELL\n");
-		get_args(f, &args[0], 1);
-		f->eax = tell(args[0]);
-		break;
-	case SYS_CLOSE:
-//	printf("SYS_CLOSE\n");
-		get_args(f, &args[0], 1);
-		close(args[0]);
-		break;
-	default:
+	const uint32_t* esp = f->esp;
+	const struct syscall* sc;
+	uint32_t args[ARGS_MAX];
+	char* strs[ARGS_MAX];
+	uint32_t nr;
+	int i;
+
+	thread_current()->user_frame = f;
+	if(!copy_from_user(&nr, esp, sizeof nr)) {
+		exit(-1);
+	}
+	if(nr >= SYSCALL_CNT || syscalls[nr].func == NULL) {
 		printf("Unimplemented system call");
 		thread_exit();
 	}
+	sc = &syscalls[nr];
+
+	if(!copy_from_user(args, esp + 1, sc->arity * sizeof *args)) {
+		exit(-1);
+	}
+	for(i = 0; i < sc->arity; i++) {
+		strs[i] = NULL;
+		if(sc->str_args & (1u << i)) {
+			strs[i] = copy_in_string((const char*) args[i]);
+			args[i] = (uint32_t) strs[i];
+		}
+	}
+	f->eax = sc->func(args);
+	for(i = 0; i < sc->arity; i++) {
+		palloc_free_page(strs[i]);
+	}
+}
+
+static uint32_t sys_halt(const uint32_t* args UNUSED){
+	halt();
+	NOT_REACHED();
+}
+
+static uint32_t sys_exit(const uint32_t* args){
+	exit(args[0]);
+	NOT_REACHED();
+}
+
+static uint32_t sys_exec(const uint32_t* args){
+	return exec((const char*) args[0]);
+}
+
+static uint32_t sys_wait(const uint32_t* args){
+	return wait(args[0]);
+}
+
+static uint32_t sys_create(const uint32_t* args){
+	return create((const char*) args[0], args[1]);
+}
+
+static uint32_t sys_remove(const uint32_t* args){
+	return remove((const char*) args[0]);
+}
+
+static uint32_t sys_open(const uint32_t* args){
+	return open((const char*) args[0]);
+}
+
+static uint32_t sys_filesize(const uint32_t* args){
+	return filesize(args[0]);
+}
+
+static uint32_t sys_read(const uint32_t* args){
+	return read(args[0], (void*) args[1], args[2]);
+}
+
+static uint32_t sys_write(const uint32_t* args){
+	return write(args[0], (const void*) args[1], args[2]);
+}
+
+static uint32_t sys_seek(const uint32_t* args){
+	seek(args[0], args[1]);
+	return 0;
+}
+
+static uint32_t sys_tell(const uint32_t* args){
+	return tell(args[0]);
+}
+
+static uint32_t sys_close(const uint32_t* args){
+	close(args[0]);
+	return 0;
+}
+
+static uint32_t sys_chdir(const uint32_t* args){
+	return chdir((const char*) args[0]);
+}
+
+static uint32_t sys_mkdir(const uint32_t* args){
+	return mkdir((const char*) args[0]);
+}
+
+static uint32_t sys_readdir(const uint32_t* args){
+	return readdir(args[0], (char*) args[1]);
+}
+
+static uint32_t sys_isdir(const uint32_t* args){
+	return isdir(args[0]);
+}
+
+static uint32_t sys_inumber(const uint32_t* args){
+	return inumber(args[0]);
+}
+
+static uint32_t sys_cachestat(const uint32_t* args){
+	return cachestat((struct cache_stats*) args[0]);
+}
+
+static uint32_t sys_pread(const uint32_t* args){
+	return pread(args[0], (void*) args[1], args[2], args[3]);
+}
+
+static uint32_t sys_pwrite(const uint32_t* args){
+	return pwrite(args[0], (const void*) args[1], args[2], args[3]);
+}
+
+static uint32_t sys_readv(const uint32_t* args){
+	return readv(args[0], (const struct iovec*) args[1], args[2]);
+}
+
+static uint32_t sys_writev(const uint32_t* args){
+	return writev(args[0], (const struct iovec*) args[1], args[2]);
+}
+
+static uint32_t sys_fork(const uint32_t* args UNUSED){
+	return fork();
 }
 
 void halt(void){
@@ -155,16 +281,7 @@ void exit(int status){
 }
 
 pid_t exec(const char* cmd_line){
-	tid_t child;
-
-	if(cmd_line >=PHYS_BASE || get_user(cmd_line) == -1){	//REED, I need your max cmd Line char limit---- looked at process.c -> seems PHYS_BASE is the max
-		exit(-1);
-		return -1;
-	}else{
-		//printf("EXECUTING %s\n", cmd_line);
-		child = process_execute(cmd_line);
-		return child;
-	}
+	return process_execute(cmd_line);
 }
 
 int wait(pid_t pid){
@@ -172,68 +289,38 @@ int wait(pid_t pid){
 }
 
 bool create(const char* file, unsigned initial_size){
-	if(file) {
-		if(checkMemorySpace((void*) file, initial_size)) {
-			//printf("creating filesys\n");
-			return filesys_create(file, initial_size);
-		}
-	}
-	return -1;
-	/*if(file + initial_size > PHYS_BASE || get_user(file + initial_size -1) == -1){
-		exit(-1);
-		return -1;
-	}else{
-		return filesys_create(file, initial_size);
-	}*/
+	return filesys_create(file, initial_size);
 }
 
 bool remove(const char* file){
-	if(user_to_kernel_ptr((void*) file)) {
-		return filesys_remove(file);
-	}
-	/*if(file >= PHYS_BASE || get_user(file) == -1){
-		exit(-1);
-		return -1;
-	}else{
-		return filesys_remove(file);
-	}*/
+	return filesys_remove(file);
 }
 
 int open(const char* file){
-	//printf("OPEN STARTS with %s\n", file);
-	//printf("File pointer is at %p\n", file);
-	if(user_to_kernel_ptr((void*) file)) {
-		//printf("OPEN DID NOT FAIL\n");
-		//debug_backtrace();
-		lock_acquire(&file_sys_lock);
-		//printf("Lock acquired.\n");
-		//printf("File name = %s\n", file);
-		struct file* f = filesys_open(file);
-		if(!f) {
-			//printf("NULL FILE\n");
-			free(f);
-			lock_release(&file_sys_lock);
-			return -1;
-		}
-		struct file_desc* fd = palloc_get_page(0);
-		fd->file = f;
-		if(list_empty(&(thread_current()->file_descrips))) {
-			fd->id = 3;
-		}
-		else {
-			fd->id = list_entry(list_back(&(thread_current()->file_descrips)), struct file_desc, elem)->id + 1;
-		}
-		list_push_back(&(thread_current()->file_descrips), &(fd->elem));
+	lock_acquire(&file_sys_lock);
+	//printf("Lock acquired.\n");
+	//printf("File name = %s\n", file);
+	struct file* f = filesys_open(file);
+	if(!f) {
+		//printf("NULL FILE\n");
+		free(f);
 		lock_release(&file_sys_lock);
-		return fd->id;
+		return -1;
 	}
-	//printf("OPEN FAILED\n");
-	return -1;
-		// Check validity of pointer
-		/*if(file >= PHYS_BASE || get_user(file) == -1 ) {
-			exit(-1);
-			return -1;
-		}*/
+	int id = alloc_fd();
+	if(id < 0) {
+		file_close(f);
+		lock_release(&file_sys_lock);
+		return -1;
+	}
+	struct file_desc* fd = get_slot(id);
+	fd->file = f;
+	fd->dir = NULL;
+	if(inode_is_dir(file_get_inode(f))) {
+		fd->dir = dir_open(inode_reopen(file_get_inode(f)));
+	}
+	lock_release(&file_sys_lock);
+	return id;
 }
 
 int filesize(int fdid){
@@ -247,66 +334,253 @@ int filesize(int fdid){
 
 }
 
-int read(int fd, void* buffer, unsigned size){
-	int result = -1;
-	unsigned offset;
-	void* page_addr;
-	struct sup_pte* stpe;
+/* Copies SIZE bytes between BUF and the user buffers in IOV,
+   starting *OFS bytes into buffer *VI and advancing both past
+   the bytes copied.  Copies into the user buffers if TO_USER is
+   true, out of them otherwise.  Returns false if a user buffer
+   turned out not to be valid memory. */
+static bool iov_copy(const struct iovec* iov, int* vi, size_t* ofs,
+                     uint8_t* buf, size_t size, bool to_user) {
+	while(size > 0) {
+		uint8_t* ubuf = (uint8_t*) iov[*vi].iov_base + *ofs;
+		size_t n = iov[*vi].iov_len - *ofs;
+		bool ok;
+
+		if(n > size) {
+			n = size;
+		}
+		ok = to_user ? copy_to_user(ubuf, buf, n)
+		             : copy_from_user(buf, ubuf, n);
+		if(!ok) {
+			return false;
+		}
+		buf += n;
+		size -= n;
+		*ofs += n;
+		if(*ofs == iov[*vi].iov_len) {
+			(*vi)++;
+			*ofs = 0;
+		}
+	}
+	return true;
+}
 
-	page_addr = pg_round_down(buffer); //page aligning the fault_addr
-	stpe = get_pte(page_addr);
-	if(stpe != NULL) {
-		if(!stpe->writable) {
+/* Reads from (or, if WRITE is true, writes to) open file FD into
+   (from) the IOV_CNT user buffers in IOV, which are in kernel
+   memory, at the file's position if POS is negative or at byte
+   POS otherwise.  Returns the number of bytes transferred, or -1
+   if FD is not an open file.
+
+   The data goes through a kernel buffer of up to
+   IO_BOUNCE_PAGES, so that a bad user buffer never faults while
+   the file system is locked, and each buffer's worth takes
+   file_sys_lock once and is a single inode operation however
+   many user buffers it spans. */
+static int file_io(int fd, const struct iovec* iov, int iov_cnt, off_t pos,
+                   bool write) {
+	struct file_desc* file_d;
+	struct file* file;
+	size_t total = 0, done = 0, bounce_size, ofs = 0;
+	uint8_t* bounce;
+	int i, vi = 0;
+
+	for(i = 0; i < iov_cnt; i++) {
+		if(!is_user_range(iov[i].iov_base, iov[i].iov_len)) {
 			exit(-1);
 		}
+		if(iov[i].iov_len > INT32_MAX - total) {
+			return -1;
+		}
+		total += iov[i].iov_len;
 	}
 
-	if(checkMemorySpace(buffer, size)) {
+	lock_acquire(&file_sys_lock);
+	file_d = get_fd(fd);
+	file = file_d && !file_d->dir ? file_d->file : NULL;
+	lock_release(&file_sys_lock);
+	if(file == NULL) {
+		return -1;
+	}
+	if(total == 0) {
+		return 0;
+	}
 
-		// If reading from stdin
-		if(fd == STDIN_FILENO) {
-			uint8_t* local_buffer = (uint8_t*) buffer;
-			for(offset = 0; offset < size; offset++) {
-				local_buffer[offset] = input_getc();
-			}
-			return size;
+	bounce_size = DIV_ROUND_UP(total, PGSIZE);
+	if(bounce_size > IO_BOUNCE_PAGES) {
+		bounce_size = IO_BOUNCE_PAGES;
+	}
+	bounce = palloc_get_multiple(0, bounce_size);
+	if(bounce == NULL) {
+		bounce_size = 1;
+		bounce = palloc_get_page(0);
+		if(bounce == NULL) {
+			return -1;
+		}
+	}
+	bounce_size *= PGSIZE;
+
+	while(done < total) {
+		size_t chunk = total - done < bounce_size ? total - done : bounce_size;
+		off_t n;
+
+		if(write && !iov_copy(iov, &vi, &ofs, bounce, chunk, false)) {
+			palloc_free_multiple(bounce, bounce_size / PGSIZE);
+			exit(-1);
 		}
 
-		// If reading from a file
 		lock_acquire(&file_sys_lock);
-		struct file_desc* file_d = get_fd(fd);
-		if(file_d && file_d->file) {
-			result = file_read(file_d->file, buffer, size);
+		if(pos < 0) {
+			n = write ? file_write(file, bounce, chunk)
+			          : file_read(file, bounce, chunk);
+		}
+		else {
+			n = write ? file_write_at(file, bounce, chunk, pos + done)
+			          : file_read_at(file, bounce, chunk, pos + done);
 		}
 		lock_release(&file_sys_lock);
+		if(n <= 0) {
+			break;
+		}
+
+		if(!write && !iov_copy(iov, &vi, &ofs, bounce, n, true)) {
+			palloc_free_multiple(bounce, bounce_size / PGSIZE);
+			exit(-1);
+		}
+		done += n;
+		if((size_t) n < chunk) {
+			break;
+		}
 	}
-	return result;
+	palloc_free_multiple(bounce, bounce_size / PGSIZE);
+	return done;
 }
 
-int write(int fd, const void* buffer, unsigned size){
-	int result = -1;
+/* Copies the IOV_CNT-element iovec array at user address UIOV
+   into KIOV, which has room for IOV_MAX.  Returns false if
+   IOV_CNT is out of range.  Exits if UIOV is not valid. */
+static bool copy_in_iov(struct iovec* kiov, const struct iovec* uiov,
+                        int iov_cnt) {
+	if(iov_cnt < 0 || iov_cnt > IOV_MAX) {
+		return false;
+	}
+	if(!copy_from_user(kiov, uiov, iov_cnt * sizeof *kiov)) {
+		exit(-1);
+	}
+	return true;
+}
+
+/* Writes the IOV_CNT buffers in IOV, which are in user memory,
+   to the console, a page at a time.  Returns the number of bytes
+   written, or -1 if out of memory or the total overflows an int.
+   Exits the process if a buffer is not valid user memory. */
+static int console_write(const struct iovec* iov, int iov_cnt){
+	size_t total = 0, offset;
+	char* bounce;
+	int i;
 
-	if(checkMemorySpace(buffer, size)) {
-		// If writing to console
-		if(fd == STDOUT_FILENO) {
-			size_t offset = 0;
-			while(offset + 200 < size) {
-				putbuf((char*)(buffer + offset), (size_t) 200);
-				offset = offset + 200;
+	for(i = 0; i < iov_cnt; i++) {
+		if(!is_user_range(iov[i].iov_base, iov[i].iov_len)) {
+			exit(-1);
+		}
+		if(iov[i].iov_len > INT32_MAX - total) {
+			return -1;
+		}
+		total += iov[i].iov_len;
+	}
+
+	bounce = palloc_get_page(0);
+	if(bounce == NULL) {
+		return -1;
+	}
+	for(i = 0; i < iov_cnt; i++) {
+		const uint8_t* buffer = iov[i].iov_base;
+		size_t size = iov[i].iov_len;
+
+		for(offset = 0; offset < size; offset += PGSIZE) {
+			size_t chunk = size - offset < PGSIZE ? size - offset : PGSIZE;
+			if(!copy_from_user(bounce, buffer + offset, chunk)) {
+				palloc_free_page(bounce);
+				exit(-1);
 			}
-			putbuf((char*)(buffer + offset), (size_t) (size - offset));
-			return size;
+			putbuf(bounce, chunk);
 		}
+	}
+	palloc_free_page(bounce);
+	return total;
+}
 
-		// If writing to a file
-		lock_acquire(&file_sys_lock);
-		struct file_desc* file_d = get_fd(fd);
-		if(file_d && file_d->file) {
-			result = file_write(file_d->file, buffer, size);
+int read(int fd, void* buffer, unsigned size){
+	struct iovec iov = {buffer, size};
+	unsigned offset;
+
+	// If reading from stdin
+	if(fd == STDIN_FILENO) {
+		uint8_t* local_buffer = (uint8_t*) buffer;
+
+		if(!is_user_range(buffer, size)) {
+			exit(-1);
 		}
-		lock_release(&file_sys_lock);
-	}	
-	return result;
+		for(offset = 0; offset < size; offset++) {
+			if(!put_user(local_buffer + offset, input_getc())) {
+				exit(-1);
+			}
+		}
+		return size;
+	}
+
+	return file_io(fd, &iov, 1, -1, false);
+}
+
+int write(int fd, const void* buffer, unsigned size){
+	struct iovec iov = {(void*) buffer, size};
+
+	if(fd == STDOUT_FILENO) {
+		return console_write(&iov, 1);
+	}
+	return file_io(fd, &iov, 1, -1, true);
+}
+
+int pread(int fd, void* buffer, unsigned size, unsigned offset){
+	struct iovec iov = {buffer, size};
+
+	if((off_t) offset < 0) {
+		return -1;
+	}
+	return file_io(fd, &iov, 1, offset, false);
+}
+
+int pwrite(int fd, const void* buffer, unsigned size, unsigned offset){
+	struct iovec iov = {(void*) buffer, size};
+
+	if((off_t) offset < 0) {
+		return -1;
+	}
+	return file_io(fd, &iov, 1, offset, true);
+}
+
+int readv(int fd, const struct iovec* iov, int iov_cnt){
+	struct iovec kiov[IOV_MAX];
+
+	if(!copy_in_iov(kiov, iov, iov_cnt)) {
+		return -1;
+	}
+	return file_io(fd, kiov, iov_cnt, -1, false);
+}
+
+int writev(int fd, const struct iovec* iov, int iov_cnt){
+	struct iovec kiov[IOV_MAX];
+
+	if(!copy_in_iov(kiov, iov, iov_cnt)) {
+		return -1;
+	}
+	if(fd == STDOUT_FILENO) {
+		return console_write(kiov, iov_cnt);
+	}
+	return file_io(fd, kiov, iov_cnt, -1, true);
+}
+
+pid_t fork(void){
+	return process_fork(thread_current()->user_frame);
 }
 
 void seek(int fd, unsigned position){
@@ -333,108 +607,208 @@ void close(int fd){
 	lock_acquire(&file_sys_lock);
 	struct file_desc* filed = get_fd(fd);
 	if(filed && filed->file) {
-		file_close(filed->file);
-		list_remove(&(filed->elem));
-		palloc_free_page(filed);
+		free_fd(fd);
+	}
+	lock_release(&file_sys_lock);
+}
+
+bool chdir(const char* dir){
+	bool success;
+
+	lock_acquire(&file_sys_lock);
+	success = filesys_chdir(dir);
+	lock_release(&file_sys_lock);
+	return success;
+}
+
+bool mkdir(const char* dir){
+	bool success;
+
+	lock_acquire(&file_sys_lock);
+	success = filesys_mkdir(dir);
+	lock_release(&file_sys_lock);
+	return success;
+}
+
+bool readdir(int fd, char* name){
+	char kname[NAME_MAX + 1];
+	bool success = false;
+
+	lock_acquire(&file_sys_lock);
+	struct file_desc* filed = get_fd(fd);
+	if(filed && filed->dir) {
+		success = dir_readdir(filed->dir, kname);
+	}
+	lock_release(&file_sys_lock);
+	if(success && !copy_to_user(name, kname, strlen(kname) + 1)) {
+		exit(-1);
+	}
+	return success;
+}
+
+bool isdir(int fd){
+	bool result = false;
+
+	lock_acquire(&file_sys_lock);
+	struct file_desc* filed = get_fd(fd);
+	if(filed && filed->file) {
+		result = filed->dir != NULL;
+	}
+	lock_release(&file_sys_lock);
+	return result;
+}
+
+int inumber(int fd){
+	int result = -1;
+
+	lock_acquire(&file_sys_lock);
+	struct file_desc* filed = get_fd(fd);
+	if(filed && filed->file) {
+		result = inode_get_inumber(file_get_inode(filed->file));
 	}
 	lock_release(&file_sys_lock);
+	return result;
+}
+
+bool cachestat(struct cache_stats* stats){
+	struct cache_stats s;
+
+	cache_get_stats(&s);
+	if(!copy_to_user(stats, &s, sizeof s)) {
+		exit(-1);
+	}
+	return true;
 }
 
+/* Returns the slot for FD in the current process's descriptor
+   table.  FD must be within the table. */
+static struct file_desc* get_slot(int fd) {
+	return &thread_current()->fds[fd - FD_MIN];
+}
+
+/* Returns the open file descriptor FD, or a null pointer if FD
+   is not open. */
 struct file_desc* get_fd(int fd) {
-	// Get thread list
 	struct thread* t = thread_current();
 
-	// Find the file descriptor 
-	struct list_elem* e = list_begin(&t->file_descrips);
-	while(e != list_end(&t->file_descrips)) {
-		struct file_desc* d = list_entry(e, struct file_desc, elem);
-		if(d->id == fd) {
-			return d;
-		}
-		e = list_next(e);
+	if(fd < FD_MIN || fd - FD_MIN >= t->fd_cnt
+	   || t->fds[fd - FD_MIN].file == NULL) {
+		return NULL;
 	}
-	return NULL;
+	return get_slot(fd);
 }
 
-void check_valid_pointer(void* addr) {
-	if(!is_user_vaddr(addr) || addr < USER_VADDR_BOTTOM) {
-		//printf("INVALID POINTER\n");
-		exit(-1);
+/* Returns the lowest free file descriptor in the current
+   process's table, growing the table if it is full, or -1 if
+   there is no memory to grow it.  The caller fills in the
+   slot. */
+static int alloc_fd(void) {
+	struct thread* t = thread_current();
+	int i;
+
+	for(i = t->fd_free; i < t->fd_cnt; i++) {
+		if(t->fds[i].file == NULL) {
+			break;
+		}
 	}
+	if(i == t->fd_cnt) {
+		int cnt = t->fd_cnt ? t->fd_cnt * 2 : FD_INIT_CNT;
+		struct file_desc* fds = realloc(t->fds, cnt * sizeof *fds);
+		if(fds == NULL) {
+			return -1;
+		}
+		memset(fds + t->fd_cnt, 0, (cnt - t->fd_cnt) * sizeof *fds);
+		t->fds = fds;
+		t->fd_cnt = cnt;
+	}
+	t->fd_free = i + 1;
+	return i + FD_MIN;
 }
 
-int user_to_kernel_ptr(void* vaddr) {
-	check_valid_pointer(vaddr);
-        void *kpage;
-        vaddr = pg_round_down(vaddr);
-        struct thread *t = thread_current();
-	void* ptr = pagedir_get_page(thread_current()->pagedir, vaddr);
-	if(!ptr) {
-		//printf("INVALID MEMORY ACCESS\n");
-	  kpage = frame_allocate(PAL_USER, vaddr);
-	  struct sup_pte *spte = get_pte(vaddr);
-       //  if(!spte){
-	  switch(spte->type) {
-              case SPTE_FS: //load_page_file(spte); break;
-                 if (spte->read_bytes > 0){
-                        if (file_read_at(spte->file, kpage, spte->read_bytes, spte->offset) != (int) spte->read_bytes){
-              //              printf("Error loading file into memory %d ", spte->file);
-                            return 0;
-                        }
-                    }
-
-                   // Zero pad the rest of the page
-                   memset(kpage + spte->read_bytes, 0, spte->zero_bytes);
-                   break;
-         case SPTE_MMAP: break;
-         case SPTE_SWAP:
-              swap_read(spte->swap, kpage);
-              break;
-         case SPTE_ZERO: break;
-              memset(kpage, 0, PGSIZE);
-           break;
-         }
-             frame_set_done(kpage, true);
-             pagedir_set_dirty(t->pagedir, vaddr, false);
-             pagedir_set_page(thread_current()->pagedir, vaddr, kpage, true);
-             return 1;
-		//exit(-1);
-//	}
-	}
-	return (int) ptr;
+/* Closes open file descriptor FD and frees its slot. */
+static void free_fd(int fd) {
+	struct thread* t = thread_current();
+	struct file_desc* d = get_slot(fd);
+
+	file_close(d->file);
+	dir_close(d->dir);
+	d->file = NULL;
+	d->dir = NULL;
+	if(fd - FD_MIN < t->fd_free) {
+		t->fd_free = fd - FD_MIN;
+	}
 }
 
 void process_close_file (int fd)
 {
   struct thread *t = thread_current();
-  struct list_elem *next, *e = list_begin(&t->file_descrips);
 
-  while (e != list_end (&t->file_descrips))
+  if (fd != CLOSE_ALL)
     {
-      next = list_next(e);
-      struct file_desc *pf = list_entry (e, struct file_desc, elem);
-      if (fd == pf->id || fd == CLOSE_ALL)
-	  {
-	  file_close(pf->file);
-	  list_remove(&pf->elem);
-	  palloc_free_page(pf);
-	  if (fd != CLOSE_ALL)
-	    {
-	      return;
-	    }
-	}
-      e = next;
+      if (get_fd (fd) != NULL)
+        free_fd (fd);
+      return;
+    }
+
+  for (fd = FD_MIN; fd - FD_MIN < t->fd_cnt; fd++)
+    if (get_fd (fd) != NULL)
+      free_fd (fd);
+  free (t->fds);
+  t->fds = NULL;
+  t->fd_cnt = 0;
+  t->fd_free = 0;
+}
+
+/* Gives the current thread, a process being forked from PARENT,
+   its own copy of each of PARENT's file descriptors, at the same
+   file position.  Returns false if out of memory. */
+bool process_copy_files (struct thread *parent)
+{
+  struct thread *t = thread_current ();
+  int i;
+
+  ASSERT (t->fds == NULL);
+  if (parent->fd_cnt == 0)
+    return true;
+
+  t->fds = calloc (parent->fd_cnt, sizeof *t->fds);
+  if (t->fds == NULL)
+    return false;
+  t->fd_cnt = parent->fd_cnt;
+  t->fd_free = parent->fd_free;
+
+  lock_acquire (&file_sys_lock);
+  for (i = 0; i < parent->fd_cnt; i++)
+    {
+      const struct file_desc *p = &parent->fds[i];
+      struct file_desc *d = &t->fds[i];
+
+      if (p->file == NULL)
+        continue;
+      d->file = file_reopen (p->file);
+      if (d->file == NULL)
+        break;
+      file_seek (d->file, file_tell (p->file));
+      if (p->dir != NULL)
+        d->dir = dir_reopen (p->dir);
     }
+  lock_release (&file_sys_lock);
+  return i == parent->fd_cnt;
 }
 
 struct child_process* add_child_process (int pid)
 {
   struct child_process* cp = malloc(sizeof(struct child_process));
+  if (cp == NULL)
+    return NULL;
   cp->pid = pid;
   cp->load = NOT_LOADED;
   cp->wait = false;
   cp->exit = false;
+  cp->status = ERROR;
   lock_init(&cp->wait_lock);
+  sema_init(&cp->sem_die, 0);
+  sema_init(&cp->sem_read, 0);
   list_push_back(&thread_current()->child_threads,
 		 &cp->elem);
   return cp;
@@ -479,35 +853,104 @@ void remove_child_processes (void)
     }
 }
 
-void get_args(struct intr_frame* f, int* arg, int n) {
-	int i;
-	int* ptr;
-	for(i = 0; i < n; i++) {
-		ptr = (int*) f->esp + i + 1;
-		check_valid_pointer((void*)ptr);
-		arg[i] = *ptr;
-	}
-}
+/* Returns true if the SIZE bytes starting at UADDR all lie in
+   user memory above the null page region. */
+static bool is_user_range(const void* uaddr, size_t size) {
+	const uint8_t* p = uaddr;
 
-int get_four_bytes_user(const void* addr) {
-	// if the address goes past physical memory
-	if(addr >= PHYS_BASE) {
-		exit(-1);
-	}
+	return size == 0
+	       || (p >= (const uint8_t*) USER_VADDR_BOTTOM && is_user_vaddr(p)
+	           && size <= (size_t) ((const uint8_t*) PHYS_BASE - p));
 }
 
-// Gets byte at user virtual address
+/* Reads a byte at user virtual address UADDR.
+   Returns the byte value if successful, -1 if UADDR is not
+   valid user memory.  A fault on UADDR lands in page_fault(),
+   which either brings the page in or resumes at the label held
+   in EAX with EAX set to -1. */
 int get_user(const uint8_t* uaddr) {
 	int result;
+
+	if(!is_user_vaddr(uaddr)) {
+		return -1;
+	}
 	asm("movl $1f, %0; movzbl %1, %0; 1:" : "=&a" (result) : "m" (*uaddr));
 	return result;
 }
 
-int checkMemorySpace(void* vaddr, int size) {
-	int i;
-	for(i = 0; i < size; i+=PGSIZE) {
-		if(user_to_kernel_ptr(vaddr+i) == 0) return 0;
+/* Writes BYTE to user address UDST.
+   Returns true if successful, false if UDST is not valid,
+   writable user memory. */
+bool put_user(uint8_t* udst, uint8_t byte) {
+	int error_code;
+
+	if(!is_user_vaddr(udst)) {
+		return false;
 	}
-	return 1;
+	asm("movl $1f, %0; movb %b2, %1; 1:"
+	    : "=&a" (error_code), "=m" (*udst) : "q" (byte));
+	return error_code != -1;
+}
+
+/* Copies SIZE bytes from SRC to DST, either of which may be in
+   user memory that has already been bounds checked.  A fault
+   that brings a page in resumes the string move where it
+   stopped; one that can't makes EAX nonzero. */
+static bool user_copy(void* dst, const void* src, size_t size) {
+	int result;
+
+	asm volatile("movl $1f, %%eax; rep movsb; xorl %%eax, %%eax; 1:"
+	             : "=&a" (result), "+D" (dst), "+S" (src), "+c" (size)
+	             : : "memory");
+	return result == 0;
 }
 
+/* Copies SIZE bytes from user address USRC to kernel buffer
+   DST.  Returns false if any of them is not valid user memory. */
+bool copy_from_user(void* dst, const void* usrc, size_t size) {
+	return is_user_range(usrc, size) && user_copy(dst, usrc, size);
+}
+
+/* Copies SIZE bytes from kernel buffer SRC to user address
+   UDST.  Returns false if any of them is not valid, writable
+   user memory. */
+bool copy_to_user(void* udst, const void* src, size_t size) {
+	return is_user_range(udst, size) && user_copy(udst, src, size);
+}
+
+/* Copies the null-terminated string at user address USRC into
+   DST, which has room for SIZE bytes.  Returns the length of
+   the string, SIZE if it did not fit (in which case DST is not
+   null-terminated), or -1 if USRC is not valid user memory. */
+int strncpy_from_user(char* dst, const char* usrc, size_t size) {
+	size_t i;
+
+	for(i = 0; i < size; i++) {
+		int c = get_user((const uint8_t*) usrc + i);
+		if(c == -1) {
+			return -1;
+		}
+		dst[i] = c;
+		if(c == '\0') {
+			return i;
+		}
+	}
+	return size;
+}
+
+/* Returns a copy of user string USTR in a new page, truncated
+   to fit, for the caller to free with palloc_free_page().
+   Exits the process if USTR is not valid user memory. */
+static char* copy_in_string(const char* ustr) {
+	char* kstr = palloc_get_page(0);
+
+	if(kstr == NULL) {
+		exit(-1);
+	}
+	if(ustr == NULL || strncpy_from_user(kstr, ustr, PGSIZE) < 0) {
+		palloc_free_page(kstr);
+		exit(-1);
+	}
+	kstr[PGSIZE - 1] = '\0';
+	return kstr;
+}
@@ -1,6 +1,8 @@
 #ifndef USERPROG_SYSCALL_H
 #define USERPROG_SYSCALL_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include "threads/synch.h"
 
 void syscall_init (void);
@@ -8,6 +10,13 @@ void syscall_init (void);
 typedef int pid_t;
 
 #define CLOSE_ALL -1
+
+/* Lowest file descriptor handed out by open(). */
+#define FD_MIN 2
+
+/* Initial number of slots in a process's file descriptor table,
+   which doubles whenever it fills. */
+#define FD_INIT_CNT 16
 #define ERROR -1
 
 #define NOT_LOADED 0
@@ -26,6 +35,19 @@ struct child_process {
   struct list_elem elem;
 };
 
+struct thread;
+
 void process_close_file (int fd);
+bool process_copy_files (struct thread *parent);
+struct child_process *add_child_process (int pid);
+struct child_process *get_child_process (int pid);
+void remove_child_process (struct child_process *cp);
+void remove_child_processes (void);
+
+int get_user (const uint8_t *uaddr);
+bool put_user (uint8_t *udst, uint8_t byte);
+bool copy_from_user (void *dst, const void *usrc, size_t size);
+bool copy_to_user (void *udst, const void *src, size_t size);
+int strncpy_from_user (char *dst, const char *usrc, size_t size);
 
 #endif /* userprog/syscall.h */
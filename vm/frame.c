@@ -8,6 +8,7 @@
 
 #include "vm/frame.h"
 #include "filesys/file.h"
+#include "filesys/inode.h"
 #include "threads/interrupt.h"
 #include "vm/page.h"
 
@@ -15,11 +16,27 @@ static struct lock lock;
 static struct frame* get_frame(void *page);
 static struct lock evict_mutex;
 
+// Every frame in frames_list, keyed by its kernel page, so that
+// the reference counting done once per page by fork and exit
+// doesn't have to walk the list.  Under evict_mutex.
+static struct hash frames_by_page;
+static hash_hash_func kpage_hash;
+static hash_less_func kpage_less;
+
+// Page cache: frames holding read-only file pages, keyed by
+// (inode, offset), so that every process running the same
+// executable maps the same copy of its code.  Under evict_mutex.
+static struct hash shared_frames;
+static hash_hash_func share_hash;
+static hash_less_func share_less;
+
 
 void frame_init(){
 	lock_init(&lock);
 	lock_init(&evict_mutex);
 	list_init(&frames_list);
+	hash_init(&frames_by_page, kpage_hash, kpage_less, NULL);
+	hash_init(&shared_frames, share_hash, share_less, NULL);
 }
 
 // Attempt to allocate a frame
@@ -35,7 +52,10 @@ void* frame_allocate(enum palloc_flags flags, void* uaddr){
 	if(frame != NULL) {
 		// Successful adding of frame
 		//printf("Adding frame %p to table\n", uaddr);
-		add_frame(frame, uaddr);
+		if(!add_frame(frame, uaddr)) {
+			palloc_free_page(frame);
+			frame = NULL;
+		}
 	}
 	// When frame table is full, need to evict
 	else {
@@ -64,9 +84,12 @@ static bool add_frame(void* frame_addr, void* uaddr) {
 	frame->done = false;
 	frame->count = 0; 
 	frame->pinned = false;
+	frame->inode = NULL;
+	frame->refs = 1;
 	// Synchronize adding to the frame list
 	lock_acquire(&evict_mutex);
 	list_push_back(&frames_list, &frame->elem);
+	hash_insert(&frames_by_page, &frame->page_elem);
 	lock_release(&evict_mutex);
 	//printf("Successfully added frame to address %p\n", frame->page);
 	return true;
@@ -75,8 +98,10 @@ static bool add_frame(void* frame_addr, void* uaddr) {
 
 void frame_set_done(void *kpage, bool value){
 	struct frame* f;
+	lock_acquire(&evict_mutex);
 	f = get_frame(kpage);
 	f->done = value;
+	lock_release(&evict_mutex);
 }
 
 void* evict_frame(void* new_frame_uaddr){
@@ -146,7 +171,9 @@ struct frame* choose_evict(){
 
   	smallest = f->count;
   	while(e != list_tail((&frames_list))){
-  		if(f->done && smallest < f->count){
+  		// Shared frames are mapped by processes we don't track
+  		if(f->done && f->inode == NULL && f->refs == 1
+  		   && f->tid != TID_ERROR && smallest < f->count){
   			smallest = f->count;
   			frame = f; //we've found a more least recently used frame!
   		}
@@ -181,44 +208,181 @@ struct frame* choose_evict(){
   	}
  }
 
-/*return a frame mapped to a page*/
+static unsigned kpage_hash(const struct hash_elem *e, void *aux UNUSED){
+	const struct frame* f = hash_entry(e, struct frame, page_elem);
+	return hash_bytes(&f->page, sizeof f->page);
+}
+
+static bool kpage_less(const struct hash_elem *a_, const struct hash_elem *b_,
+                       void *aux UNUSED){
+	const struct frame* a = hash_entry(a_, struct frame, page_elem);
+	const struct frame* b = hash_entry(b_, struct frame, page_elem);
+	return a->page < b->page;
+}
+
+/*return a frame mapped to a page, which must be in the frame table.
+  The caller must hold evict_mutex*/
 static struct frame* get_frame(void *page){
-	struct frame* f;
-	struct list_elem *e;
-	lock_acquire(&evict_mutex);
-	e = list_head(&frames_list);
-        f = list_entry(e, struct frame, elem);
-
-        while(e != list_tail((&frames_list))){
-                if(f->page == page){
-                       break;
-                }
-                e = list_next(e); //look at next element in the list!
-                f = list_entry(e, struct frame, elem);
-        }
-	lock_release(&evict_mutex);
-	return f;
+	struct frame key;
+	struct hash_elem* e;
+
+	ASSERT(lock_held_by_current_thread(&evict_mutex));
+	key.page = page;
+	e = hash_find(&frames_by_page, &key.page_elem);
+	ASSERT(e != NULL);
+	return hash_entry(e, struct frame, page_elem);
 }
 
 void frame_free (void *frame)
 {
-  struct list_elem *e;
+  struct frame *f;
   lock_acquire(&evict_mutex);  
-  for (e = list_begin(&frames_list); e != list_end(&frames_list);
-       e = list_next(e))
-    {
-      struct frame *f = list_entry(e, struct frame, elem);
-      if (f->page == frame)
-	{
-	  list_remove(e);
-	  free(f);
-	  palloc_free_page(frame);
-	  break;
-	}
-    }
+  f = get_frame(frame);
+  list_remove(&f->elem);
+  hash_delete(&frames_by_page, &f->page_elem);
+  free(f);
+  palloc_free_page(frame);
   lock_release(&evict_mutex);
 }
 
+static unsigned share_hash(const struct hash_elem *e, void *aux UNUSED){
+	const struct frame* f = hash_entry(e, struct frame, share_elem);
+	return hash_bytes(&f->inode, sizeof f->inode) ^ hash_int(f->offset);
+}
+
+static bool share_less(const struct hash_elem *a_, const struct hash_elem *b_,
+                       void *aux UNUSED){
+	const struct frame* a = hash_entry(a_, struct frame, share_elem);
+	const struct frame* b = hash_entry(b_, struct frame, share_elem);
+
+	if(a->inode != b->inode)
+		return a->inode < b->inode;
+	if(a->offset != b->offset)
+		return a->offset < b->offset;
+	return a->read_bytes < b->read_bytes;
+}
 
+// Returns the frame holding READ_BYTES of INODE from OFFSET,
+// followed by zeros, and takes a reference to it.  Returns NULL
+// if no process has that page loaded.
+void* frame_lookup_shared(struct inode* inode, off_t offset, uint32_t read_bytes){
+	struct frame key;
+	struct hash_elem* e;
+	struct frame* f = NULL;
 
+	key.inode = inode;
+	key.offset = offset;
+	key.read_bytes = read_bytes;
+	lock_acquire(&evict_mutex);
+	e = hash_find(&shared_frames, &key.share_elem);
+	if(e != NULL) {
+		f = hash_entry(e, struct frame, share_elem);
+		f->refs++;
+	}
+	lock_release(&evict_mutex);
+	return f != NULL ? f->page : NULL;
+}
 
+// Enters KPAGE, just filled with READ_BYTES of INODE from OFFSET,
+// into the page cache.  If another process loaded the same page
+// in the meantime, frees KPAGE and returns that process's frame
+// instead, with a reference taken.  The caller must release the
+// returned frame with frame_release().
+void* frame_share(void* kpage, struct inode* inode, off_t offset, uint32_t read_bytes){
+	struct frame* f;
+	struct hash_elem* e;
+
+	lock_acquire(&evict_mutex);
+	f = get_frame(kpage);
+	f->inode = inode;
+	f->offset = offset;
+	f->read_bytes = read_bytes;
+	e = hash_insert(&shared_frames, &f->share_elem);
+	if(e == NULL) {
+		f->inode = inode_reopen(inode);
+		f->done = true;
+		lock_release(&evict_mutex);
+		return kpage;
+	}
+	f->inode = NULL;
+	f = hash_entry(e, struct frame, share_elem);
+	f->refs++;
+	lock_release(&evict_mutex);
+
+	frame_free(kpage);
+	return f->page;
+}
+
+// Takes another reference to frame KPAGE, for a page table that
+// is about to map it, as fork does with pagedir_share().
+void frame_ref(void* kpage){
+	struct frame* f;
+
+	lock_acquire(&evict_mutex);
+	f = get_frame(kpage);
+	f->refs++;
+	lock_release(&evict_mutex);
+}
+
+// Returns a frame the current process may write for copy-on-write
+// frame KPAGE, which it maps at UADDR.  If no other process maps
+// KPAGE any more, that is KPAGE itself, now owned by the process.
+// Otherwise copies KPAGE to a new frame and drops the reference to
+// KPAGE.  The caller must map the returned frame writable in place
+// of KPAGE.  Returns NULL if no frame is available.
+void* frame_unshare(void* kpage, void* uaddr){
+	struct frame* f;
+	void* copy;
+
+	lock_acquire(&evict_mutex);
+	f = get_frame(kpage);
+	if(f->refs == 1) {
+		f->tid = thread_current()->tid;
+		f->uaddr = uaddr;
+		lock_release(&evict_mutex);
+		return kpage;
+	}
+	lock_release(&evict_mutex);
+
+	copy = frame_allocate(PAL_USER, uaddr);
+	if(copy == NULL) {
+		return NULL;
+	}
+	memcpy(copy, kpage, PGSIZE);
+	frame_set_done(copy, true);
+	frame_release(kpage);
+	return copy;
+}
+
+// Drops a reference to frame KPAGE, which the caller has already
+// unmapped, and frees it once no process maps it.
+void frame_release(void* kpage){
+	struct frame* f;
+	bool last;
+
+	lock_acquire(&evict_mutex);
+	f = get_frame(kpage);
+	ASSERT(f->refs > 0);
+	last = --f->refs == 0;
+	if(last) {
+		if(f->inode != NULL) {
+			hash_delete(&shared_frames, &f->share_elem);
+		}
+		list_remove(&f->elem);
+		hash_delete(&frames_by_page, &f->page_elem);
+	}
+	else if(f->tid == thread_current()->tid) {
+		// The remaining mapper is unknown until it writes to the
+		// frame, see frame_unshare(), so keep it from eviction
+		f->tid = TID_ERROR;
+	}
+	lock_release(&evict_mutex);
+
+	if(last) {
+		if(f->inode != NULL) {
+			inode_close(f->inode);
+		}
+		palloc_free_page(f->page);
+		free(f);
+	}
+}
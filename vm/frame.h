@@ -1,15 +1,28 @@
 
 #include "threads/thread.h"
 #include "threads/palloc.h"
+#include "lib/kernel/hash.h"
+#include "filesys/off_t.h"
+
+struct inode;
 
 struct frame{
 	void* page;
 	tid_t tid;
 	struct list_elem elem;
+	struct hash_elem page_elem;	// element in frames_by_page
 	void* uaddr;
 	bool done;
         bool pinned;
 	int count;	// checks which frame is the oldest for eviction policy
+
+	int refs;		// page tables mapping the frame
+
+	// Read-only file page shared between processes, see frame_share()
+	struct inode* inode;	// file the page came from, NULL if not shared
+	off_t offset;		// offset of the page in the file
+	uint32_t read_bytes;	// bytes read from the file, the rest is zero
+	struct hash_elem share_elem;
 };
 
 struct list frames_list;
@@ -22,3 +35,8 @@ struct frame* choose_evict();
 void age_frames(int64_t timer_ticks);
 void frame_set_done(void *kpage, bool value);
 void frame_free (void *frame);
+void* frame_lookup_shared(struct inode* inode, off_t offset, uint32_t read_bytes);
+void* frame_share(void* kpage, struct inode* inode, off_t offset, uint32_t read_bytes);
+void frame_ref(void* kpage);
+void* frame_unshare(void* kpage, void* uaddr);
+void frame_release(void* kpage);
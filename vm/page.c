@@ -4,6 +4,9 @@
 #include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/palloc.h"
+#include "vm/frame.h"
+#include "vm/swap.h"
+#include <string.h>
 
 static struct lock spte_lock;
 
@@ -129,6 +132,55 @@ void delete_sup_pt(){
 	lock_release(&spte_lock);
 }
 
+/*
+	copy the supplemental page table of PARENT, which must not be
+	running, into the current thread's for fork.  Pages not yet
+	loaded from PARENT's executable will be loaded from FILE, the
+	child's own copy of it, since PARENT closes its copy on exit.
+	Pages in memory are shared afterwards by pagedir_share(), so
+	pages PARENT has in swap are read back in first: a swap slot
+	can only be read once
+*/
+bool copy_sup_pt(struct thread *parent, struct file *file){
+	struct thread* t = thread_current();
+	struct hash_iterator i;
+
+	hash_first(&i, &parent->sup_pagedir);
+	while(hash_next(&i)) {
+		struct sup_pte *p = hash_entry(hash_cur(&i), struct sup_pte, elem);
+		struct sup_pte *spte;
+		bool ok;
+
+		if(p->type == SPTE_SWAP && p->swapped
+		   && pagedir_get_page(parent->pagedir, p->uaddr) == NULL) {
+			void *kpage = frame_allocate(PAL_USER, p->uaddr);
+			if(kpage == NULL)
+				return false;
+			swap_read(p->swap, kpage);
+			frame_set_done(kpage, true);
+			if(!pagedir_set_page(parent->pagedir, p->uaddr, kpage, p->writable)) {
+				frame_free(kpage);
+				return false;
+			}
+		}
+
+		spte = malloc(sizeof(struct sup_pte));
+		if(spte == NULL)
+			return false;
+		*spte = *p;
+		if(p->file == parent->file)
+			spte->file = file;
+		lock_acquire(&spte_lock);
+		ok = hash_insert(&t->sup_pagedir, &spte->elem) == NULL;
+		lock_release(&spte_lock);
+		if(!ok) {
+			free(spte);
+			return false;
+		}
+	}
+	return true;
+}
+
 /*
 	free spte
 */
@@ -172,6 +224,37 @@ bool load_page_file (struct sup_pte *spte)
   return true;
 }
 
+/*
+	map a read-only page of an executable, sharing the frame with
+	every other process that has the same page loaded and reading
+	it from the file only if none has
+*/
+bool load_page_shared (struct sup_pte *spte)
+{
+  struct inode *inode = file_get_inode(spte->file);
+  uint8_t *frame;
 
+  ASSERT (spte->type == SPTE_FS && !spte->writable);
 
+  frame = frame_lookup_shared(inode, spte->offset, spte->read_bytes);
+  if (frame == NULL){
+      frame = frame_allocate(PAL_USER, spte->uaddr);
+      if (frame == NULL){
+	  return false;
+	}
+      if (file_read_at(spte->file, frame, spte->read_bytes, spte->offset) != (int) spte->read_bytes){
+	  frame_free(frame);
+	  return false;
+	}
+      memset(frame + spte->read_bytes, 0, spte->zero_bytes);
+      frame = frame_share(frame, inode, spte->offset, spte->read_bytes);
+    }
+  if (!pagedir_set_page((thread_current())->pagedir, spte->uaddr, frame, false)){
+      frame_release(frame);
+      return false;
+  }
 
+  spte->kaddr = frame;
+  spte->loadded = true;
+  return true;
+}
@@ -4,6 +4,8 @@
 #include "filesys/file.h"
 #include "lib/kernel/hash.h"
 
+struct thread;
+
 #define PGSIZE 4096
 
 // State of pages
@@ -47,4 +49,8 @@ bool zero_sup_pte(void *uaddr, bool writable);
 
 bool load_page_file (struct sup_pte *spte);
 
+bool load_page_shared (struct sup_pte *spte);
+
+bool copy_sup_pt(struct thread *parent, struct file *file);
+
 #endif //_Page_h_